@@ -0,0 +1,81 @@
+#ifndef juwhan_argument_storage_h
+#define juwhan_argument_storage_h
+
+#include <type_traits>
+#include "juwhan_std.h"
+#include "fast_function.h"
+
+// This header file defines a variable length argument storage.
+// It is the common storage of thread_task and parameter_pack.
+//
+// Each stored value is an element tagged with its position. An element of an empty class type(a stateless functor, a tag, and etc) is inherited instead of being held as a member, so that it takes no space at all(empty base optimization). There is no limit on the number of elements.
+
+namespace juwhan {
+
+
+// A stored value, held as a member.
+    template<size_t I, typename T, bool = ::std::is_empty<T>::value && !__is_final(T)>
+    struct argument_storage_element {
+        T value;
+
+        template<typename U>
+        explicit argument_storage_element(U &&value_) : value(::juwhan::forward<U>(value_)) {};
+
+        T &get() { return value; };
+    };
+
+// A stored value of an empty type, held as a base.
+    template<size_t I, typename T>
+    struct argument_storage_element<I, T, true> : private T {
+        template<typename U>
+        explicit argument_storage_element(U &&value_) : T(::juwhan::forward<U>(value_)) {};
+
+        T &get() { return *this; };
+    };
+
+
+// Pick an element by its position. The element type is deduced, so no type list walking is needed.
+    template<size_t I, typename T, bool E>
+    inline T &get_argument(argument_storage_element<I, T, E> &element) {
+        return element.get();
+    };
+
+
+    template<typename S, typename... A>
+    struct argument_storage_implementation {
+    };
+
+    template<size_t... I, typename... A>
+    struct argument_storage_implementation<index_sequence<I...>, A...> : argument_storage_element<I, A> ... {
+        static constexpr size_t size = sizeof...(A);
+
+        template<typename... AA>
+        explicit argument_storage_implementation(AA &&... args)
+                : argument_storage_element<I, A>(::juwhan::forward<AA>(args))... {};
+
+        template<size_t J>
+        auto get() -> decltype(get_argument<J>(*this)) { return get_argument<J>(*this); };
+    };
+
+
+    template<typename... A>
+    using argument_storage = argument_storage_implementation<index_sequence_for<A...>, A...>;
+
+
+// The stored form of a callable.
+// A functor(including a lambda) is kept by value, so that a stateless one takes no space and a stateful one outlives the caller's copy. A static function is kept as a plain pointer.
+// A member function is bound to its object in a fast_function.
+    template<typename F, bool = function_type_deduction<F>::is_member>
+    struct callable_storage {
+        using type = F;
+    };
+
+    template<typename F>
+    struct callable_storage<F, true> {
+        using type = fast_function<typename function_type_deduction<F>::simplified_traits>;
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
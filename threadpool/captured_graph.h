@@ -0,0 +1,209 @@
+#ifndef juwhan_captured_graph_h
+#define juwhan_captured_graph_h
+
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <vector>
+
+#include "juwhan_std.h"
+#include "thread_task.h"
+#include "task_group.h"
+
+// This header file defines captured, replayable task graphs.
+//
+// Put a pool in capture mode, and the tasks submitted(or posted) from the capturing thread are recorded instead of being run. A receipt issued during the capture and passed as an argument to a later submission becomes a dependency edge.
+// When the capture ends, the record is frozen into an immutable graph: one node array, precomputed predecessor counts, and successor lists packed in a single array.
+// Replaying the graph allocates nothing. It resets the counters and the results, releases the roots, and helps until all nodes are done.
+//
+// Usage.
+//
+//     captured_graph<threadpool> g{threadpool::instance};
+//     threadpool::instance.begin_capture(g);
+//     auto a = threadpool::instance.submit(load, batch);
+//     auto b = threadpool::instance.submit(parse, a);    // parse takes a threadpool_receit<...>. a is an argument, hence b depends on a.
+//     auto c = threadpool::instance.submit(index, b);
+//     threadpool::instance.end_capture();
+//     for (...) {
+//         g.replay();
+//         use(c.get());
+//     }
+//
+// Do not wait on a receipt while capturing. Its task has not run and will not run until a replay.
+
+#define cg_info(...)
+#define cg_info_if(...)
+
+namespace juwhan {
+
+
+// Find the result a submission argument depends on. Receipts carry ret.base; anything else has none.
+    template<typename A>
+    inline auto argument_dependency(A &argument, int) -> decltype(argument.ret.base) {
+        return argument.ret.base;
+    };
+
+    template<typename A>
+    inline function_return_type_base_implementation *argument_dependency(A &, long) {
+        return nullptr;
+    };
+
+
+// The recording side of a captured graph. A pool talks to this while it is in capture mode.
+    struct graph_capture {
+        ::std::vector<thread_task *> captured_tasks;
+        ::std::vector<function_return_type_base_implementation *> captured_results;
+        ::std::vector<size_t> edge_sources;
+        ::std::vector<size_t> edge_targets;
+
+        graph_capture() : captured_tasks{}, captured_results{}, edge_sources{}, edge_targets{} {};
+
+        // Reserve a node. Its task is filled in by set_node, after the dependencies are known.
+        size_t add_node() {
+            captured_tasks.push_back(nullptr);
+            captured_results.push_back(nullptr);
+            return captured_tasks.size() - 1;
+        };
+
+        void set_node(size_t node, thread_task *task, function_return_type_base_implementation *result) {
+            captured_tasks[node] = task;
+            captured_results[node] = result;
+        };
+
+        // Add an edge from the node that produced the dependency. Results from outside the capture are ignored.
+        void add_dependency(size_t node, function_return_type_base_implementation *dependency) {
+            if (!dependency) return;
+            for (auto i = node; i-- > 0;) {
+                if (captured_results[i] == dependency) {
+                    edge_sources.push_back(i);
+                    edge_targets.push_back(node);
+                    return;
+                }
+            }
+        };
+
+        virtual void finish() = 0;
+
+        virtual ~graph_capture() {};
+    };
+
+
+    template<typename TP>
+    struct captured_graph : public graph_capture {
+        // A node. It wraps a captured task, which is run again on every replay.
+        struct node : public thread_task {
+            captured_graph *graph;
+            thread_task *task;
+            function_return_type_base_implementation *result;
+            size_t successor_begin;
+            size_t successor_end;
+            size_t predecessor_count;
+            ::std::atomic<size_t> pending;
+
+            node() : graph{nullptr}, task{nullptr}, result{nullptr}, successor_begin{0}, successor_end{0},
+                     predecessor_count{0}, pending{0} {};
+
+            void operator()() {
+                // Tasks with a receipt catch their own exceptions. Only posted ones throw up to here.
+                try { (*task)(); }
+                catch (::std::exception &e) { graph->state.set_exception(e); }
+                catch (...) {
+                    ::std::runtime_error e{"A captured task threw an exception that is not a ::std::exception."};
+                    graph->state.set_exception(e);
+                }
+                for (auto i = successor_begin; i < successor_end; ++i) {
+                    auto successor = graph->successors[i];
+                    if (successor->pending.fetch_sub(1, ::std::memory_order_acq_rel) == 1)
+                        graph->tp.enqueue(successor);
+                }
+                // This must be the last touch of the graph. The replaying thread may return right after.
+                graph->state.pending.fetch_sub(1, ::std::memory_order_acq_rel);
+            };
+
+            bool is_pool_owned() const { return false; };
+        };
+
+        TP &tp;
+        task_group_state state;
+        node *nodes;
+        size_t node_count;
+        ::std::vector<node *> successors;
+        ::std::vector<node *> roots;
+
+        explicit captured_graph(TP &tp_)
+                : graph_capture{}, tp(tp_), state{}, nodes{nullptr}, node_count{0}, successors{}, roots{} {};
+
+        // A captured_graph may not be copied, moved, or assigned to another.
+        captured_graph(captured_graph &other) = delete;
+
+        captured_graph(captured_graph &&other) = delete;
+
+        captured_graph &operator=(captured_graph &other) = delete;
+
+        captured_graph &operator=(captured_graph &&other) = delete;
+
+        ~captured_graph() {
+            if (!state.is_done()) {
+                auto s = &state;
+                tp.help_until([s] { return s->is_done(); });
+            }
+            for (size_t i = 0; i < node_count; ++i) delete nodes[i].task;
+            delete[] nodes;
+        };
+
+        size_t size() { return node_count; };
+
+        // Freeze the record. Called by the pool when the capture ends.
+        void finish() {
+            cg_info("I will freeze a captured graph.");
+            node_count = captured_tasks.size();
+            nodes = new node[node_count];
+            // Count successors, then pack them by source node.
+            ::std::vector<size_t> offsets(node_count + 1, 0);
+            for (size_t i = 0; i < edge_sources.size(); ++i) ++offsets[edge_sources[i] + 1];
+            for (size_t i = 0; i < node_count; ++i) offsets[i + 1] += offsets[i];
+            successors.resize(edge_sources.size());
+            ::std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < edge_sources.size(); ++i) {
+                successors[fill[edge_sources[i]]++] = &nodes[edge_targets[i]];
+                ++nodes[edge_targets[i]].predecessor_count;
+            }
+            for (size_t i = 0; i < node_count; ++i) {
+                nodes[i].graph = this;
+                nodes[i].task = captured_tasks[i];
+                nodes[i].result = captured_results[i];
+                nodes[i].successor_begin = offsets[i];
+                nodes[i].successor_end = offsets[i + 1];
+                if (nodes[i].predecessor_count == 0) roots.push_back(&nodes[i]);
+            }
+            // The record is not needed any more.
+            ::std::vector<thread_task *>{}.swap(captured_tasks);
+            ::std::vector<function_return_type_base_implementation *>{}.swap(captured_results);
+            ::std::vector<size_t>{}.swap(edge_sources);
+            ::std::vector<size_t>{}.swap(edge_targets);
+        };
+
+        // Run the captured graph once more and return when every node is done.
+        // The first exception thrown by a node is rethrown here as a runtime_error.
+        void replay() {
+            if (node_count == 0) return;
+            for (size_t i = 0; i < node_count; ++i) {
+                nodes[i].pending.store(nodes[i].predecessor_count, ::std::memory_order_relaxed);
+                if (nodes[i].result) nodes[i].result->unset();
+            }
+            state.pending.store(node_count, ::std::memory_order_release);
+            cg_info("I will release the roots of a captured graph.");
+            for (size_t i = 0; i < roots.size(); ++i) tp.enqueue(roots[i]);
+            auto s = &state;
+            tp.help_until([s] { return s->is_done(); });
+            if (state.is_exceptional()) {
+                state._is_exceptional.store(false, ::std::memory_order_relaxed);
+                throw ::std::runtime_error(state.exception_message);
+            }
+        };
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
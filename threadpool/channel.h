@@ -0,0 +1,255 @@
+#ifndef juwhan_channel_h
+#define juwhan_channel_h
+
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+
+#include "juwhan_std.h"
+#include "aligned_circular_array.h"
+
+#include "include_me.h"
+
+// This header file defines a bounded channel between tasks of a pool.
+//
+// A channel is a ring of cells, each with a sequence number, after Dmitry Vyukov's bounded MPMC queue. Any number of tasks send into it and receive from it.
+// A sender claims a cell by advancing the send position with one compare and swap, fills it, and publishes it by bumping the sequence of the cell. A receiver does the same on the other side. There is no lock.
+// Batches claim a run of ready cells with a single compare and swap, and wake waiters once per batch.
+//
+// When the channel is full(or empty), a sender(or receiver) checks again for a little while, and then helps the pool through steal_until rather than blocking its thread.
+// It helps only with tasks of the other threads. Had it run a task of its own queue, that could be the other end of the channel, which would then block under it for good.
+// So the two ends must be able to run on different threads, i.e. the pool needs two threads or more. The constructor throws a runtime_error otherwise, rather than leave the first blocked end waiting for good.
+// On the threadpool, a thread with nothing to steal sleeps. A channel operation that may meet the condition of such a thread wakes the pool, but only when somebody is waiting.
+//
+// Close the channel after the last send has returned. Receivers then drain what is left, after which receive returns false. Sending to a closed channel throws a runtime_error.
+// T must be default constructible, and is moved in and out of the cells.
+//
+// Usage.
+//
+//     channel<threadpool, int> ch{threadpool::instance, 1024};
+//     auto producer = threadpool::instance.submit([&] {
+//         for (int i = 0; i < n; ++i) ch.send(i);
+//         ch.close();
+//     });
+//     int item;
+//     while (ch.receive(item)) consume(item);
+
+#define ch_info(...)
+#define ch_info_if(...)
+
+// The number of times a blocked send or receive checks again before it helps the pool.
+#ifndef JUWHAN_CHANNEL_SPIN_COUNT
+#define JUWHAN_CHANNEL_SPIN_COUNT 64
+#endif
+
+namespace juwhan {
+
+
+    template<typename TP, typename T>
+    struct channel {
+        struct cell {
+            ::std::atomic<size_t> sequence;
+            T value;
+        };
+
+        TP &tp;
+        size_t mask;
+        cell *cells;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+        ::std::atomic<size_t> send_position;
+        char pad1[JUWHAN_CACHELINE_SIZE];
+        ::std::atomic<size_t> receive_position;
+        char pad2[JUWHAN_CACHELINE_SIZE];
+        ::std::atomic<size_t> waiting;
+        ::std::atomic<bool> closed;
+        char pad3[JUWHAN_CACHELINE_SIZE];
+
+        // The capacity is rounded up to a power of 2.
+        channel(TP &tp_, size_t capacity_)
+                : tp(tp_), mask{next_power_of_2(capacity_ < 2 ? size_t{2} : capacity_) - 1}, cells{nullptr},
+                  send_position{0}, receive_position{0}, waiting{0}, closed{false} {
+            if (tp.thread_count() < 2) throw ::std::runtime_error("A channel needs a pool of two threads or more.");
+            cells = new cell[mask + 1];
+            for (size_t i = 0; i <= mask; ++i) cells[i].sequence.store(i, ::std::memory_order_relaxed);
+        };
+
+        ~channel() { delete[] cells; };
+
+        channel(channel &other) = delete;
+
+        channel &operator=(channel &other) = delete;
+
+        size_t capacity() { return mask + 1; };
+
+        // A snapshot. It may be stale as soon as it is returned.
+        size_t size() {
+            auto received = receive_position.load(::std::memory_order_relaxed);
+            auto sent = send_position.load(::std::memory_order_relaxed);
+            return sent > received ? sent - received : 0;
+        };
+
+        bool is_closed() { return closed.load(::std::memory_order_acquire); };
+
+        void close() {
+            closed.store(true, ::std::memory_order_release);
+            wake();
+        };
+
+        // Claim up to max cells from position on, whose sequences are position + offset. Return how many, and the first in first.
+        // Senders look for offset 0(freed cells), receivers for offset 1(filled cells).
+        size_t claim(::std::atomic<size_t> &position, size_t offset, size_t max, size_t &first) {
+            auto current = position.load(::std::memory_order_relaxed);
+            while (true) {
+                size_t count{0};
+                while (count < max && cells[(current + count) & mask].sequence.load(::std::memory_order_acquire) == current + count + offset) ++count;
+                if (count == 0) {
+                    auto sequence = cells[current & mask].sequence.load(::std::memory_order_acquire);
+                    // Behind: full for senders, empty for receivers.
+                    if (static_cast<::std::intptr_t>(sequence - (current + offset)) < 0) return 0;
+                    // Somebody else took the cell. Start over from where they left.
+                    current = position.load(::std::memory_order_relaxed);
+                    continue;
+                }
+                if (position.compare_exchange_weak(current, current + count, ::std::memory_order_relaxed)) {
+                    first = current;
+                    return count;
+                }
+            }
+        };
+
+        // A sleeping waiter checks its condition after it counts itself in, and this checks the count after the change.
+        void wake() {
+            ::std::atomic_thread_fence(::std::memory_order_seq_cst);
+            if (waiting.load(::std::memory_order_relaxed) > 0) tp.notify();
+        };
+
+        // The next cell is free, or closed. It is checked under the lock of the pool, so it only looks.
+        bool can_send() {
+            auto current = send_position.load(::std::memory_order_relaxed);
+            auto sequence = cells[current & mask].sequence.load(::std::memory_order_acquire);
+            return static_cast<::std::intptr_t>(sequence - current) >= 0 || is_closed();
+        };
+
+        // The next cell is filled, or closed.
+        bool can_receive() {
+            auto current = receive_position.load(::std::memory_order_relaxed);
+            auto sequence = cells[current & mask].sequence.load(::std::memory_order_acquire);
+            return static_cast<::std::intptr_t>(sequence - (current + 1)) >= 0 || is_closed();
+        };
+
+        // Closed, and every item sent has been received.
+        bool is_drained() {
+            return is_closed() && receive_position.load(::std::memory_order_acquire) == send_position.load(::std::memory_order_acquire);
+        };
+
+        // Check the condition for a while, and then help the other threads until it is met.
+        template<typename P>
+        void wait_until(P condition) {
+            for (auto i = 0; i < JUWHAN_CHANNEL_SPIN_COUNT; ++i) if (condition()) return;
+            ch_info("The channel is still blocked. I will help the pool.");
+            bool is_met{false};
+            waiting.fetch_add(1, ::std::memory_order_seq_cst);
+            tp.steal_until([&is_met, &condition] { return is_met = condition(); });
+            waiting.fetch_sub(1, ::std::memory_order_relaxed);
+            if (!is_met) throw ::std::runtime_error("The pool was destroyed while waiting on a channel.");
+        };
+
+        // Send what [first, first + max) holds, as much as fits. Return how many were sent.
+        template<typename I>
+        size_t send_some(I first, size_t max) {
+            if (is_closed()) throw ::std::runtime_error("Sent to a closed channel.");
+            if (max == 0) return 0;
+            size_t position;
+            auto count = claim(send_position, 0, max, position);
+            for (size_t i = 0; i < count; ++i, ++first) {
+                auto &c = cells[(position + i) & mask];
+                c.value = *first;
+                c.sequence.store(position + i + 1, ::std::memory_order_release);
+            }
+            if (count > 0) wake();
+            return count;
+        };
+
+        // Receive up to max items into out. Return how many were received.
+        template<typename O>
+        size_t receive_some(O &out, size_t max) {
+            if (max == 0) return 0;
+            size_t position;
+            auto count = claim(receive_position, 1, max, position);
+            for (size_t i = 0; i < count; ++i, ++out) {
+                auto &c = cells[(position + i) & mask];
+                *out = ::juwhan::move(c.value);
+                c.sequence.store(position + i + mask + 1, ::std::memory_order_release);
+            }
+            if (count > 0) wake();
+            return count;
+        };
+
+        // Non-blocking. A value that does not fit is left as it is.
+        bool try_send(const T &value) { return send_some(&value, 1) == 1; };
+
+        bool try_send(T &&value) { return send_some(::std::make_move_iterator(&value), 1) == 1; };
+
+        bool try_receive(T &value) {
+            auto out = &value;
+            return receive_some(out, 1) == 1;
+        };
+
+        // Send as many of [first, last) as fit, and return the first one not sent.
+        template<typename I>
+        I try_send_batch(I first, I last) {
+            auto count = send_some(first, ::std::distance(first, last));
+            ::std::advance(first, count);
+            return first;
+        };
+
+        // Receive up to max items into out, and return how many.
+        template<typename O>
+        size_t try_receive_batch(O out, size_t max) { return receive_some(out, max); };
+
+        // Blocking. They help the pool while the channel is full.
+        void send(const T &value) {
+            while (!try_send(value)) wait_until([this] { return can_send(); });
+        };
+
+        void send(T &&value) {
+            while (!try_send(::juwhan::move(value))) wait_until([this] { return can_send(); });
+        };
+
+        // Send all of [first, last), in as few claims as the room allows.
+        template<typename I>
+        void send_batch(I first, I last) {
+            while (first != last) {
+                auto next = try_send_batch(first, last);
+                if (next == first) wait_until([this] { return can_send(); });
+                first = next;
+            }
+        };
+
+        // Blocking. They help the pool while the channel is empty, and return false(or 0) once it is closed and drained.
+        bool receive(T &value) {
+            while (!try_receive(value)) {
+                if (is_drained()) return false;
+                wait_until([this] { return can_receive(); });
+            }
+            return true;
+        };
+
+        // Receive at least one and up to max items into out, and return how many.
+        template<typename O>
+        size_t receive_batch(O out, size_t max) {
+            if (max == 0) return 0;
+            while (true) {
+                auto count = receive_some(out, max);
+                if (count > 0) return count;
+                if (is_drained()) return 0;
+                wait_until([this] { return can_receive(); });
+            }
+        };
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef juwhan_combinable_h
+#define juwhan_combinable_h
+
+#include <vector>
+
+#include "juwhan_std.h"
+
+// This header file defines combinable, per-worker storage on top of a pool.
+//
+// Each worker of the pool gets its own slot, found by the pool's worker index. Slots are padded to keep workers from sharing cache lines.
+// Workers accumulate into their own slot without atomics, and the slots are combined once at the end.
+//
+// Usage.
+//
+//     combinable<threadpool, size_t> count{threadpool::instance, 0};
+//     parallel_for(threadpool::instance, blocked_range<size_t>{0, n}, [&](const blocked_range<size_t> &r) {
+//         auto &local = count.local();
+//         for (auto i = r.begin(); i != r.end(); ++i) if (is_prime(i)) ++local;
+//     });
+//     auto total = count.combine([](size_t a, size_t b) { return a + b; });
+
+namespace juwhan {
+
+
+    template<typename T>
+    struct combinable_slot {
+        T value;
+        bool is_used;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+
+        explicit combinable_slot(const T &value_) : value(value_), is_used{false} {};
+    };
+
+
+    template<typename TP, typename T>
+    struct combinable {
+        TP &tp;
+        T identity;
+        ::std::vector<combinable_slot<T>> slots;
+
+        explicit combinable(TP &tp_, const T &identity_ = T{})
+                : tp(tp_), identity(identity_), slots(tp_.thread_count(), combinable_slot<T>{identity_}) {};
+
+        // The slot of the calling worker. It starts as the identity.
+        T &local() {
+            auto &slot = slots[tp.worker_index()];
+            slot.is_used = true;
+            return slot.value;
+        };
+
+        // Fold the used slots into one value, in worker order, starting from the identity.
+        template<typename F>
+        T combine(F func) {
+            T result(identity);
+            for (size_t i = 0; i < slots.size(); ++i) if (slots[i].is_used) result = func(result, slots[i].value);
+            return result;
+        };
+
+        // Call func on each used slot.
+        template<typename F>
+        void combine_each(F func) {
+            for (size_t i = 0; i < slots.size(); ++i) if (slots[i].is_used) func(slots[i].value);
+        };
+
+        // Reset all slots to the identity.
+        void clear() {
+            for (size_t i = 0; i < slots.size(); ++i) {
+                slots[i].value = identity;
+                slots[i].is_used = false;
+            }
+        };
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
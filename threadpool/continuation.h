@@ -0,0 +1,268 @@
+#ifndef juwhan_continuation_h
+#define juwhan_continuation_h
+
+#include <atomic>
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
+#include <string>
+
+#include "juwhan_std.h"
+#include "thread_task.h"
+
+// This header file defines continuations on receipts.
+//
+// then(): receipt.then(func) schedules func(result) onto the pool as soon as the result is set. Nobody waits for it in between.
+// when_all(): a receipt that is set when every receipt in a range is set.
+// when_any(): a receipt that is set to the index of the first receipt in a range to be set.
+//
+// Both when_all and when_any are driven by continuations on the inputs, so a thread waiting on the combined receipt goes through a single wait instead of one per input.
+// All of them work for any pool type whose receipts carry ret and tp(threadpool and greedy_threadpool).
+// A result that is never set(e.g. its task was flushed at destroy()) deletes its continuations with it. Their receipts are never set either.
+
+#define cnt_info(...)
+#define cnt_info_if(...)
+
+namespace juwhan {
+
+
+// The result type of a continuation. func takes the antecedent's result, or nothing when it is void.
+    template<typename F, typename T>
+    struct continuation_result {
+        using type = typename function_traits<typename decay<F>::type>::result_type;
+    };
+
+
+// Call func with the antecedent's result and set ret.
+    template<typename R, typename T>
+    struct continuation_invoker {
+        template<typename F>
+        static void invoke(F &func, function_return_type<T> &antecedent, function_return_type<R> &ret) {
+            ret.set(func(antecedent.get()));
+        };
+    };
+
+    template<typename T>
+    struct continuation_invoker<void, T> {
+        template<typename F>
+        static void invoke(F &func, function_return_type<T> &antecedent, function_return_type<void> &ret) {
+            func(antecedent.get());
+            ret.set();
+        };
+    };
+
+    template<typename R>
+    struct continuation_invoker<R, void> {
+        template<typename F>
+        static void invoke(F &func, function_return_type<void> &antecedent, function_return_type<R> &ret) {
+            ret.set(func());
+        };
+    };
+
+    template<>
+    struct continuation_invoker<void, void> {
+        template<typename F>
+        static void invoke(F &func, function_return_type<void> &antecedent, function_return_type<void> &ret) {
+            func();
+            ret.set();
+        };
+    };
+
+
+// The task a continuation runs. It has a result of its own, and shares the antecedent's once that is set.
+// Until then it holds no share. Otherwise a result that is never set would be kept alive by its own continuation.
+    template<typename F, typename T>
+    struct continuation_task : public thread_task {
+        using result_type = typename continuation_result<F, T>::type;
+        F func;
+        function_return_type<T> antecedent;
+        function_return_type<result_type> ret;
+
+        template<typename FF>
+        continuation_task(FF &&func_, function_return_type<T> &antecedent_)
+                : func(::juwhan::forward<FF>(func_)), antecedent{antecedent_}, ret{} {
+            antecedent.base->unshare();
+        };
+
+        // The antecedent is set. Take a share, for the task may run after every other holder is gone.
+        void hold() { antecedent.base->share(); };
+
+        // The antecedent is gone without being set. Forget it, for there is no share to give back.
+        void abandon() { antecedent.base = nullptr; };
+
+        void operator()() {
+            // An exceptional antecedent skips the continuation and passes the exception on.
+            if (antecedent.is_exceptional()) {
+                ret.set_exception(antecedent.get_exception());
+                return;
+            }
+            try { continuation_invoker<result_type, T>::invoke(func, antecedent, ret); }
+            catch (::std::exception &e) { ret.set_exception(e); }
+            catch (...) {
+                ::std::runtime_error e{"A continuation threw an exception that is not a ::std::exception."};
+                ret.set_exception(e);
+            }
+        };
+    };
+
+
+// Push a continuation task onto the pool when fired, or delete it when dropped.
+    template<typename TP, typename C>
+    struct enqueue_continuation : public function_return_continuation {
+        TP *tp;
+        C *task;
+
+        enqueue_continuation(TP &tp_, C *task_) : tp{&tp_}, task{task_} {};
+
+        void fire(function_return_type_base_implementation &) {
+            cnt_info("A result is set. I will schedule its continuation.");
+            task->hold();
+            tp->enqueue(task);
+        };
+
+        void drop() {
+            cnt_info("A result is gone without being set. I will delete its continuation.");
+            task->abandon();
+            delete task;
+        };
+
+        ~enqueue_continuation() {};
+    };
+
+
+// Schedule func onto the pool once antecedent is set. Used by the receipts' then().
+    template<typename TP, typename T, typename F>
+    inline
+    typename TP::template receipt_type<typename continuation_result<F, T>::type>
+    make_continuation(TP &tp, function_return_type<T> &antecedent, F &&func) {
+        using task_type = continuation_task<typename decay<F>::type, T>;
+        using result_type = typename task_type::result_type;
+        // Use malloc to void* free.
+        auto task = new(malloc(sizeof(task_type))) task_type{::juwhan::forward<F>(func), antecedent};
+        // Compose the receit first. If the antecedent is already set, the task may run and be gone before add_continuation returns.
+        typename TP::template receipt_type<result_type> receit{task->ret, tp};
+        antecedent.base->add_continuation(new enqueue_continuation<TP, task_type>{tp, task});
+        return receit;
+    };
+
+
+// when_all.
+    struct when_all_state {
+        ::std::atomic<size_t> remaining;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+        ::std::atomic<bool> _is_exceptional;
+        // An input went away without being set. The combined result is never set either.
+        ::std::atomic<bool> is_abandoned;
+        ::std::string exception_message;
+        function_return_type<void> ret;
+
+        explicit when_all_state(size_t count)
+                : remaining{count}, _is_exceptional{false}, is_abandoned{false}, exception_message{}, ret{} {};
+    };
+
+    struct when_all_continuation : public function_return_continuation {
+        when_all_state *state;
+
+        explicit when_all_continuation(when_all_state *state_) : state{state_} {};
+
+        void fire(function_return_type_base_implementation &source) {
+            if (source.is_exceptional()) {
+                bool expected{false};
+                if (state->_is_exceptional.compare_exchange_strong(expected, true, ::std::memory_order_relaxed))
+                    state->exception_message = source.get_exception().what();
+            }
+            if (state->remaining.fetch_sub(1, ::std::memory_order_acq_rel) == 1) {
+                cnt_info("All results in a when_all are set.");
+                if (state->is_abandoned.load(::std::memory_order_relaxed)) {
+                    // Leave it unset. Its own continuations are dropped with it.
+                } else if (state->_is_exceptional.load(::std::memory_order_relaxed)) {
+                    ::std::runtime_error e{state->exception_message};
+                    state->ret.set_exception(e);
+                } else {
+                    state->ret.set();
+                }
+                delete state;
+            }
+        };
+
+        void drop() {
+            state->is_abandoned.store(true, ::std::memory_order_relaxed);
+            if (state->remaining.fetch_sub(1, ::std::memory_order_acq_rel) == 1) delete state;
+        };
+    };
+
+
+// A receipt that is set once all receipts in [first, last) are set.
+// It is exceptional if any of them is, carrying the first exception seen.
+    template<typename I>
+    inline auto when_all(I first, I last)
+    -> typename remove_pointer<decltype(first->tp)>::type::template receipt_type<void> {
+        using pool_type = typename remove_pointer<decltype(first->tp)>::type;
+        using receipt_type = typename pool_type::template receipt_type<void>;
+        size_t count{0};
+        for (auto i = first; i != last; ++i) ++count;
+        if (count == 0) {
+            // Nothing to wait for. A receipt without a pool never waits.
+            receipt_type receit{};
+            receit.ret.set();
+            return receit;
+        }
+        auto state = new when_all_state{count};
+        receipt_type receit{state->ret, *(first->tp)};
+        for (auto i = first; i != last; ++i) i->ret.base->add_continuation(new when_all_continuation{state});
+        return receit;
+    };
+
+
+// when_any.
+    struct when_any_state {
+        ::std::atomic<size_t> remaining;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+        ::std::atomic<bool> claimed;
+        function_return_type<size_t> ret;
+
+        explicit when_any_state(size_t count) : remaining{count}, claimed{false}, ret{} {};
+    };
+
+    struct when_any_continuation : public function_return_continuation {
+        when_any_state *state;
+        size_t index;
+
+        when_any_continuation(when_any_state *state_, size_t index_) : state{state_}, index{index_} {};
+
+        void fire(function_return_type_base_implementation &) {
+            if (!state->claimed.exchange(true, ::std::memory_order_acq_rel)) {
+                cnt_info("The first result in a when_any is set.");
+                state->ret.set(index);
+            }
+            if (state->remaining.fetch_sub(1, ::std::memory_order_acq_rel) == 1) delete state;
+        };
+
+        void drop() {
+            if (state->remaining.fetch_sub(1, ::std::memory_order_acq_rel) == 1) delete state;
+        };
+    };
+
+
+// A receipt that is set to the index(counted from first) of the first receipt in [first, last) to be set.
+// The range must not be empty.
+    template<typename I>
+    inline auto when_any(I first, I last)
+    -> typename remove_pointer<decltype(first->tp)>::type::template receipt_type<size_t> {
+        using pool_type = typename remove_pointer<decltype(first->tp)>::type;
+        using receipt_type = typename pool_type::template receipt_type<size_t>;
+        size_t count{0};
+        for (auto i = first; i != last; ++i) ++count;
+        if (count == 0) throw ::std::runtime_error("when_any has been requested on an empty range of receipts.");
+        auto state = new when_any_state{count};
+        receipt_type receit{state->ret, *(first->tp)};
+        size_t index{0};
+        for (auto i = first; i != last; ++i, ++index)
+            i->ret.base->add_continuation(new when_any_continuation{state, index});
+        return receit;
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
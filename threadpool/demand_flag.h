@@ -0,0 +1,44 @@
+#ifndef juwhan_demand_flag_h
+#define juwhan_demand_flag_h
+
+#include <atomic>
+
+#include "juwhan_std.h"
+
+#include "include_me.h"
+
+// This header file defines a demand flag, through which idle workers ask busy ones for work.
+//
+// Every worker of a pool owns one. A thief that finds nothing to steal raises the flags of the others. A worker running a splittable task takes its own flag now and then, and splits off work when it was raised. spawn_or_run takes it too, and spawns instead of running in place.
+// Raising checks first, so that idle thieves polling in a loop do not keep writing to the busy workers' cache lines.
+
+namespace juwhan {
+
+
+    struct demand_flag {
+        ::std::atomic<bool> value;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+
+        demand_flag() : value{false} {};
+
+        demand_flag(demand_flag &other) = delete;
+
+        demand_flag &operator=(demand_flag &other) = delete;
+
+        bool is_raised() { return value.load(::std::memory_order_relaxed); };
+
+        void raise() {
+            if (!is_raised()) value.store(true, ::std::memory_order_relaxed);
+        };
+
+        // Lower the flag, and tell whether it was raised.
+        bool take() {
+            if (!is_raised()) return false;
+            return value.exchange(false, ::std::memory_order_relaxed);
+        };
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
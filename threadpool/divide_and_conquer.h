@@ -0,0 +1,145 @@
+#ifndef juwhan_divide_and_conquer_h
+#define juwhan_divide_and_conquer_h
+
+#include <utility>
+
+#include "juwhan_std.h"
+#include "thread_task.h"
+#include "task_group.h"
+#include "demand_flag.h"
+
+// This header file defines a divide and conquer skeleton on top of a pool.
+//
+// divide_and_conquer(pool, problem, is_base, base_solve, divide, combine) solves problem as
+//
+//     is_base(p) ? base_solve(p) : combine(p, solve(left), solve(right)), where divide(p) gives ::std::pair(left, right).
+//
+// The right half is spawned as a stack child and the left half is solved in place, as parallel_for does. Nothing is allocated per level.
+// There is no cutoff to pick. A level spawns only while the queue of the thread running it holds no more than the pool's inline threshold, or when an idle worker has raised the thread's demand flag(see spawn_statistics.h and demand_flag.h). Otherwise both halves are solved in place, and the check is made again one level down.
+// So the recursion spreads out while there are workers to take it, and goes serial when all of them are busy.
+//
+// base_solve returns the solution type S, which must be default constructible. combine(p, S left, S right) returns the solution of p.
+// When base_solve returns void, there is nothing to combine, and combine(p) is called after both halves of p are done(e.g. the merge of a merge sort).
+//
+// Usage.
+//
+//     // A quick sort. partition leaves the pivot at the cut.
+//     using range = ::std::pair<iterator, iterator>;
+//     divide_and_conquer(threadpool::instance, range{v.begin(), v.end()},
+//             [](const range &r) { return r.second - r.first <= 4096; },
+//             [](range &r) { ::std::sort(r.first, r.second); },
+//             [](range &r) { auto cut = partition(r.first, r.second); return ::std::make_pair(range{r.first, cut}, range{cut + 1, r.second}); },
+//             [](range &r) {});
+
+#define dc_info(...)
+#define dc_info_if(...)
+
+namespace juwhan {
+
+
+    template<typename TP, typename P, typename IB, typename BS, typename D, typename C, typename S>
+    struct divide_and_conquer_solver;
+
+
+// The right half of a problem, spawned as a stack child. Its solution is left in the parent's frame.
+    template<typename TP, typename P, typename IB, typename BS, typename D, typename C, typename S>
+    struct divide_and_conquer_piece {
+        divide_and_conquer_solver<TP, P, IB, BS, D, C, S> *solver;
+        P *problem;
+        S *solution;
+
+        void operator()() {
+            *solution = solver->solve(*problem, solver->tp.my_queue.get(), solver->tp.my_demand_flag());
+        };
+    };
+
+    template<typename TP, typename P, typename IB, typename BS, typename D, typename C>
+    struct divide_and_conquer_piece<TP, P, IB, BS, D, C, void> {
+        divide_and_conquer_solver<TP, P, IB, BS, D, C, void> *solver;
+        P *problem;
+
+        void operator()() {
+            solver->solve(*problem, solver->tp.my_queue.get(), solver->tp.my_demand_flag());
+        };
+    };
+
+
+// The queue and the demand flag are those of the thread solving, looked up once per thread rather than once per level.
+    template<typename TP, typename P, typename IB, typename BS, typename D, typename C, typename S>
+    struct divide_and_conquer_solver {
+        TP &tp;
+        const IB &is_base;
+        const BS &base_solve;
+        const D &divide;
+        const C &combine;
+
+        bool should_spawn(typename TP::queue_type_ptr queue, demand_flag &demand) {
+            return queue->size() <= tp.inline_threshold || demand.take();
+        };
+
+        S solve(P &problem, typename TP::queue_type_ptr queue, demand_flag &demand) {
+            if (is_base(problem)) return base_solve(problem);
+            auto halves = divide(problem);
+            if (!should_spawn(queue, demand)) {
+                S left = solve(halves.first, queue, demand);
+                S right = solve(halves.second, queue, demand);
+                return combine(problem, ::juwhan::move(left), ::juwhan::move(right));
+            }
+            S right;
+            task_group<TP> group{tp};
+            auto child = group.make_child(divide_and_conquer_piece<TP, P, IB, BS, D, C, S>{this, &halves.second, &right});
+            group.run(child);
+            S left = solve(halves.first, queue, demand);
+            group.wait();
+            return combine(problem, ::juwhan::move(left), ::juwhan::move(right));
+        };
+    };
+
+    template<typename TP, typename P, typename IB, typename BS, typename D, typename C>
+    struct divide_and_conquer_solver<TP, P, IB, BS, D, C, void> {
+        TP &tp;
+        const IB &is_base;
+        const BS &base_solve;
+        const D &divide;
+        const C &combine;
+
+        bool should_spawn(typename TP::queue_type_ptr queue, demand_flag &demand) {
+            return queue->size() <= tp.inline_threshold || demand.take();
+        };
+
+        void solve(P &problem, typename TP::queue_type_ptr queue, demand_flag &demand) {
+            if (is_base(problem)) {
+                base_solve(problem);
+                return;
+            }
+            auto halves = divide(problem);
+            if (!should_spawn(queue, demand)) {
+                solve(halves.first, queue, demand);
+                solve(halves.second, queue, demand);
+                combine(problem);
+                return;
+            }
+            task_group<TP> group{tp};
+            auto child = group.make_child(divide_and_conquer_piece<TP, P, IB, BS, D, C, void>{this, &halves.second});
+            group.run(child);
+            solve(halves.first, queue, demand);
+            group.wait();
+            combine(problem);
+        };
+    };
+
+
+// Solve problem by divide and conquer on the pool, and return the solution, if any.
+// Exceptions from the calling thread's share propagate as is. Those from spawned halves come back as a runtime_error.
+    template<typename TP, typename P, typename IB, typename BS, typename D, typename C>
+    inline typename decay<decltype(declval<const BS &>()(declval<P &>()))>::type
+    divide_and_conquer(TP &tp, P problem, const IB &is_base, const BS &base_solve, const D &divide, const C &combine) {
+        using solution_type = typename decay<decltype(declval<const BS &>()(declval<P &>()))>::type;
+        divide_and_conquer_solver<TP, P, IB, BS, D, C, solution_type> solver{tp, is_base, base_solve, divide, combine};
+        return solver.solve(problem, tp.my_queue.get(), tp.my_demand_flag());
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
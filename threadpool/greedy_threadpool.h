@@ -2,6 +2,7 @@
 #define juwhan_greedy_greedy_threadpool_h
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <exception>
 #include <stdexcept>
@@ -9,9 +10,15 @@
 
 #include "thread.h"
 #include "thread_task.h"
+#include "continuation.h"
 #include "threadlocal.h"
 #include "aligned_circular_array.h"
 #include "work_stealing_queue.h"
+#include "task_mailbox.h"
+#include "demand_flag.h"
+#include "heartbeat.h"
+#include "spawn_statistics.h"
+#include "task_sync.h"
 
 #include "include_me.h"
 
@@ -33,6 +40,10 @@ namespace juwhan {
         template<typename T>
         using receipt_type = greedy_threadpool_receit<T>;
 
+        // Exceptions thrown by posted tasks have no receipt to go to. They are handed to this handler instead.
+        // Those not derived from ::std::exception are handed over as a runtime_error saying so.
+        using exception_handler_type = void (*)(::std::exception &);
+
         struct join_guard {
             ::std::vector<thread> &threads;
 
@@ -63,14 +74,30 @@ namespace juwhan {
         // The following are read only. No need to prevent false sharing.
         ::std::vector<queue_type_ptr> master_queues;
         ::std::vector<::std::vector<queue_type_ptr>> master_neighboring_queues;
+        ::std::vector<task_mailbox *> master_mailboxes;
+        ::std::vector<demand_flag *> master_demand_flags;
+        ::std::vector<latent_tasks *> master_latent_tasks;
+        ::std::vector<spawn_counters *> master_spawn_counters;
+        ::std::vector<wait_depth *> master_wait_depths;
         threadlocal<queue_type_ptr> my_queue;
+        threadlocal<size_t> my_index;
         threadlocal<::std::vector<queue_type_ptr> *> neighboring_queues;
+        exception_handler_type exception_handler;
+        // Zero unless in heartbeat mode. See heartbeat.h.
+        ::std::chrono::steady_clock::duration heartbeat_interval;
+        // See spawn_statistics.h.
+        size_t inline_threshold;
         join_guard joiner;
 
         void make_master_queues(size_t thread_count) {
             grd_tp_info("Building queue structure for a thread pool ...");
             for (auto i = 0; i < thread_count; ++i) {
                 master_queues.push_back(new queue_type{});
+                master_mailboxes.push_back(new task_mailbox{});
+                master_demand_flags.push_back(new demand_flag{});
+                master_latent_tasks.push_back(new latent_tasks{});
+                master_spawn_counters.push_back(new spawn_counters{});
+                master_wait_depths.push_back(new wait_depth{});
             }
             grd_tp_info("Master queue is made.");
             // Make neighboring queus and put them in the master.
@@ -91,6 +118,7 @@ namespace juwhan {
             grd_tp_info("A worker (" + to_string(me) + ") has entered.");
             // Initialize threadlocal variables.
             my_queue.set(master_queues[me]);
+            my_index.set(me);
             grd_tp_info("I (" + to_string(me) + ") just set my master queue.");
             neighboring_queues.set(&master_neighboring_queues[me]);
             grd_tp_info("I (" + to_string(me) + ") just set my neighboring queues.");
@@ -98,12 +126,13 @@ namespace juwhan {
             while (!done) {
                 while (!done && active) {
                     grd_tp_info("I (" + to_string(me) + ") just entered the main working loop.");
+                    // Latent tasks left behind by a task that did not wait for them.
+                    beat();
+                    if (run_latent()) continue;
                     fetched_task = fetch_task();
                     grd_tp_info_if(fetched_task, "I(" + to_string(me) + ") fetched a job.");
                     if (fetched_task) {
-                        (*fetched_task)();
-                        // Delete the done-with task.
-                        delete fetched_task;
+                        execute(fetched_task);
                     } else {
                         this_thread::yield();  // This is a greedy threadpool. Just yield for a moment and keep crunching.
                     }
@@ -125,6 +154,7 @@ namespace juwhan {
             grd_tp_info("The main queue related to thread (" + to_string(me) + ") has been flushed.");
             // Now, release the queue. Note that the threadlocal queue is just an alias to the thread specific queue.
             my_queue.release();
+            my_index.release();
             grd_tp_info("The main queue related to thread (" + to_string(me) + ") has been released.");
             neighboring_queues.release();
             grd_tp_info("The neighbor queues related to thread (" + to_string(me) + ") has been released.");
@@ -143,12 +173,15 @@ namespace juwhan {
 
         // The default constructor.
         greedy_threadpool(size_t thread_count = 0)
-                : done{false}, joiner{threads}, master_queues{}, my_queue{}, neighboring_queues{},
-                  master_neighboring_queues{}, mut{}, cond{}, active{false} {
+                : done{false}, joiner{threads}, master_queues{}, master_mailboxes{}, master_demand_flags{}, master_latent_tasks{}, master_spawn_counters{}, master_wait_depths{},
+                  my_queue{}, my_index{}, neighboring_queues{},
+                  master_neighboring_queues{}, mut{}, cond{}, active{false}, exception_handler{nullptr},
+                  heartbeat_interval{::std::chrono::steady_clock::duration::zero()}, inline_threshold{JUWHAN_INLINE_THRESHOLD} {
             if (thread_count == 0) thread_count = thread::hardware_concurrency();
             make_master_queues(thread_count);
             // Initialize threadlocal variables for main.
             my_queue.set(master_queues[0]);
+            my_index.set(size_t{0});
             grd_tp_info("I(0) the master thread set my master queue.");
             neighboring_queues.set(&master_neighboring_queues[0]);
             grd_tp_info("I(0) the master thread set my neighboring queues.");
@@ -182,8 +215,22 @@ namespace juwhan {
             // Join.
             for (auto i = 0; i < threads.size(); ++i) threads[i].join();
             grd_tp_info("Now, all threads are joined.");
+            // No worker flushes the queue and the mailbox of this thread. Tasks left there would leak, and so would their results and continuations.
+            while (auto task = my_queue->pop()) if (task->is_pool_owned()) delete task;
+            while (auto task = master_mailboxes[my_index.get()]->pop()) if (task->is_pool_owned()) delete task;
             // Delete queues.
             for (auto i = 0; i < master_queues.size(); ++i) delete master_queues[i];
+            for (auto i = 0; i < master_mailboxes.size(); ++i) delete master_mailboxes[i];
+            for (auto i = 0; i < master_demand_flags.size(); ++i) delete master_demand_flags[i];
+            // Latent tasks of threads that are not workers, this one included, were never flushed.
+            for (auto i = 0; i < master_latent_tasks.size(); ++i) {
+                while (auto task = master_latent_tasks[i]->pop()) if (task->is_pool_owned()) delete task;
+                delete master_latent_tasks[i];
+            }
+            for (auto i = 0; i < master_spawn_counters.size(); ++i) delete master_spawn_counters[i];
+            for (auto i = 0; i < master_wait_depths.size(); ++i) delete master_wait_depths[i];
+            // The index of this thread was allocated in the constructor.
+            my_index.release();
             grd_tp_info("Now, all master queues are deleted.");
         };
 
@@ -196,13 +243,17 @@ namespace juwhan {
 
         void flush() {
             grd_tp_info("I will flush my queue.");
-            while (auto task = my_queue->pop()) delete task;
+            while (auto task = my_queue->pop()) if (task->is_pool_owned()) delete task;
+            while (auto task = master_mailboxes[my_index.get()]->pop()) if (task->is_pool_owned()) delete task;
+            while (auto task = master_latent_tasks[my_index.get()]->pop()) if (task->is_pool_owned()) delete task;
         };
 
 
         // Fetch a task.
         thread_task *fetch_task() {
             grd_tp_info("OK, I am about to fetch a task.");
+            // Tasks mailed to me come first. They were sent to me for what I have in cache.
+            if (auto mailed_task = master_mailboxes[my_index.get()]->pop()) return mailed_task;
             auto fetched_task = my_queue->pop();
             if (fetched_task) return fetched_task;
             // My queue is empty. Try to steal from neighbors, including the main queue.
@@ -213,26 +264,290 @@ namespace juwhan {
                 if (fetched_task) return fetched_task;
             }
             grd_tp_info("I could not steal from my neighbors including the main queues.");
+            // Take mail sent to others rather than stay idle.
+            for (auto i = 0; i < master_mailboxes.size(); ++i) {
+                if (auto mailed_task = master_mailboxes[i]->pop()) return mailed_task;
+            }
+            // Ask the busy ones to split off work.
+            raise_demand();
+            return nullptr;
+        };
+
+
+        // Steal a task from the others: their queues, then their mail. My own queue and mail are left alone.
+        thread_task *steal_task() {
+            for (auto i = 0; i < neighboring_queues->size(); ++i) {
+                auto fetched_task = (*neighboring_queues)[i]->steal();
+                if (fetched_task) return fetched_task;
+            }
+            auto me = my_index.get();
+            for (auto i = 0; i < master_mailboxes.size(); ++i) {
+                if (i == me) continue;
+                if (auto mailed_task = master_mailboxes[i]->pop()) return mailed_task;
+            }
+            raise_demand();
             return nullptr;
         };
 
 
+        // Raise the demand flags of all the others.
+        void raise_demand() {
+            auto me = my_index.get();
+            for (auto i = 0; i < master_demand_flags.size(); ++i) if (i != me) master_demand_flags[i]->raise();
+        };
+
+
+        // Execute a fetched task and delete it, if the pool owns it.
+        void execute(thread_task *task) {
+            auto is_pool_owned = task->is_pool_owned();
+            // Tasks with a receipt catch their own exceptions. Only detached ones throw up to here.
+            try {
+                (*task)();
+            }
+            catch (::std::exception &e) {
+                if (exception_handler) exception_handler(e);
+            }
+            catch (...) {
+                // Anything else reaches the handler as a runtime_error, so that it is not lost silently.
+                ::std::runtime_error e{"A posted task threw an exception that is not a ::std::exception."};
+                if (exception_handler) exception_handler(e);
+            }
+            // Delete the done-with task.
+            if (is_pool_owned) delete task;
+        };
+
+
+        // Help executing tasks until the condition is met. Wait while the pool is stopped.
+        template<typename P>
+        void help_until(P condition) {
+            grd_tp_info("I am a waiting thread. I will try to process pending tasks while waiting.");
+            while (!condition() && !done) {
+                while (!condition() && active && !done) {
+                    // My own latent tasks come first. The one waited for is usually the newest.
+                    beat();
+                    if (run_latent()) continue;
+                    auto fetched_task = fetch_task();
+                    if (fetched_task) {
+                        grd_tp_info("I picked up a task while waiting for a condition to be met.");
+                        execute(fetched_task);
+                    } else {
+                        this_thread::yield();
+                    }
+                }
+                // The condition has the upper most priority.
+                // Done is the second.
+                // Someone stoppped the thread.
+                if (!condition() && !done) {
+                    ::std::unique_lock<::std::mutex> lock{mut};
+                    cond.wait(lock, [this] { return (active.load() || done.load()); });
+                    lock.unlock();
+                }
+            } // The condition is met or the threadpool is done with.
+        };
+
+
+        // Help with the tasks of the other threads only, until the condition is met. Wait while the pool is stopped.
+        // The tasks of this thread are left for the others, so that the task waited for never runs under the waiting one, e.g. the other end of a channel.
+        template<typename P>
+        void steal_until(P condition) {
+            grd_tp_info("I am a waiting thread. I will steal from the others while waiting.");
+            promote_latent();
+            while (!condition() && !done) {
+                while (!condition() && active && !done) {
+                    auto stolen_task = steal_task();
+                    if (stolen_task) {
+                        execute(stolen_task);
+                    } else {
+                        this_thread::yield();
+                    }
+                }
+                if (!condition() && !done) {
+                    ::std::unique_lock<::std::mutex> lock{mut};
+                    cond.wait(lock, [this] { return (active.load() || done.load()); });
+                    lock.unlock();
+                }
+            }
+        };
+
+
+        // Push a task into my queue.
+        void enqueue(thread_task *task) {
+            my_queue->push(task);
+        };
+
+
+        // Keep a task latent in this thread, and promote the oldest one into my queue if a heartbeat is due.
+        void defer(thread_task *task) {
+            auto &latent = *master_latent_tasks[my_index.get()];
+            latent.push(task);
+            if (auto promoted_task = latent.promote(heartbeat_interval)) enqueue(promoted_task);
+        };
+
+
+        // Promote my oldest latent task into my queue if a heartbeat is due. Nothing to do unless in heartbeat mode.
+        void beat() {
+            auto &latent = *master_latent_tasks[my_index.get()];
+            if (latent.empty()) return;
+            if (auto promoted_task = latent.promote(heartbeat_interval)) enqueue(promoted_task);
+        };
+
+
+        // Promote all my latent tasks into my queue, oldest first, where the others can take them.
+        // A wait that does not run my own tasks calls it first, or a latent task that would meet its condition runs nowhere.
+        void promote_latent() {
+            auto &latent = *master_latent_tasks[my_index.get()];
+            while (auto promoted_task = latent.promote(::std::chrono::steady_clock::duration::zero())) enqueue(promoted_task);
+        };
+
+
+        // The number of latent tasks promoted by heartbeats so far, over all threads.
+        size_t promoted_count() {
+            size_t count{0};
+            for (size_t i = 0; i < master_latent_tasks.size(); ++i)
+                count += master_latent_tasks[i]->promoted.load(::std::memory_order_relaxed);
+            return count;
+        };
+
+
+        // Run the newest latent task of this thread, if any.
+        bool run_latent() {
+            auto task = master_latent_tasks[my_index.get()]->pop();
+            if (!task) return false;
+            grd_tp_info("I will run a latent task inline.");
+            execute(task);
+            return true;
+        };
+
+
+        // Turn the heartbeat mode on with a beat every given microseconds, or off with 0. See heartbeat.h.
+        // Set it while the pool is idle. It is read without a lock.
+        void set_heartbeat(size_t microseconds) {
+            heartbeat_interval = ::std::chrono::microseconds{microseconds};
+        };
+
+
+        // Send a task to the worker at index. It takes the task before its own queue, and others take it only when idle.
+        void mail(thread_task *task, size_t index) {
+            master_mailboxes[index]->push(task);
+        };
+
+
+        // The number of tasks mailed so far, over all workers. Tells whether an affinity_partitioner is sending pieces back to their workers.
+        size_t mail_count() {
+            size_t count{0};
+            for (size_t i = 0; i < master_mailboxes.size(); ++i) count += master_mailboxes[i]->received_count();
+            return count;
+        };
+
+
+        // help_until keeps checking its condition, and sleeps only while the pool is stopped. There is nobody to wake.
+        void notify() {};
+
+
+        // Wait until the condition is met, without running any task. A greedy pool does not sleep, so just yield. See task_sync.h.
+        template<typename P>
+        void park_until(P condition) {
+            grd_tp_info("I will park until a condition is met.");
+            promote_latent();
+            while (!condition() && !done) this_thread::yield();
+        };
+
+
+        // How deep this thread is in waits of task_sync.h that help the pool.
+        size_t &my_wait_depth() { return master_wait_depths[my_index.get()]->value; };
+
+
+        // The demand flag of this thread. Splittable tasks poll it. See splittable_task.h.
+        demand_flag &my_demand_flag() { return *master_demand_flags[my_index.get()]; };
+
+
+        // The number of threads working on this pool, including the main thread.
+        size_t thread_count() { return master_queues.size(); };
+
+
+        // The index of this thread in the pool, from 0(the main thread) to thread_count() - 1.
+        size_t worker_index() { return my_index.get(); };
+
+
+        // Set the handler for exceptions thrown by posted tasks. Set it before posting; it is read without a lock.
+        void set_exception_handler(exception_handler_type handler) {
+            exception_handler = handler;
+        };
+
+
         // Submit a task.
         template<typename F, typename... A>
-        greedy_threadpool_receit<typename thread_task_implementation<typename decay<F>::type, typename decay<A>::type...>::result_type>
+        greedy_threadpool_receit<typename task_type_for<F, A...>::result_type>
         submit(F &&_func, A &&... args) {
-            using task_type = thread_task_implementation<typename decay<F>::type, typename decay<A>::type...>;
+            using task_type = task_type_for<F, A...>;
             using result_type = typename task_type::result_type;
             grd_tp_info("I'll submit a task");
             // Make a task.
             thread_task *new_task = make_task(juwhan::forward<F>(_func), juwhan::forward<A>(args)...);
             grd_tp_info("I just generated a task.");
             // Compose a receit.
-            greedy_threadpool_receit<result_type> receit{(reinterpret_cast<task_type *>(new_task))->ret, *this};
-            my_queue->push(new_task);
+            greedy_threadpool_receit<result_type> receit{(static_cast<task_type *>(new_task))->ret, *this};
+            if (heartbeat_interval != ::std::chrono::steady_clock::duration::zero()) {
+                defer(new_task);
+                return receit;
+            }
+            enqueue(new_task);
             return receit;
         };
 
+
+        // Submit a task, or run it right here if my queue is deep enough and nobody is asking for work. See spawn_statistics.h.
+        template<typename F, typename... A>
+        greedy_threadpool_receit<typename task_type_for<F, A...>::result_type>
+        spawn_or_run(F &&_func, A &&... args) {
+            using task_type = task_type_for<F, A...>;
+            using result_type = typename task_type::result_type;
+            auto &counters = *master_spawn_counters[my_index.get()];
+            // A raised flag is answered by this spawn, so it is taken down.
+            if (my_queue->size() <= inline_threshold || my_demand_flag().take()) {
+                counters.count_spawned();
+                return submit(juwhan::forward<F>(_func), juwhan::forward<A>(args)...);
+            }
+            grd_tp_info("My queue is deep and nobody is hungry. I will run the task in place.");
+            counters.count_inlined();
+            // The task lives in this frame only. The receipt keeps its result.
+            task_type local_task{juwhan::forward<F>(_func), juwhan::forward<A>(args)...};
+            local_task();
+            return greedy_threadpool_receit<result_type>{local_task.ret, *this};
+        };
+
+
+        // Set how many tasks my queue must hold before spawn_or_run runs tasks in place. Set it while the pool is idle.
+        void set_inline_threshold(size_t threshold) {
+            inline_threshold = threshold;
+        };
+
+
+        // The counts of spawn_or_run over all threads, and the threshold in use.
+        spawn_statistics spawn_stats() {
+            spawn_statistics stats{0, 0, inline_threshold};
+            for (auto i = 0; i < master_spawn_counters.size(); ++i) {
+                stats.spawned += master_spawn_counters[i]->spawned.load(::std::memory_order_relaxed);
+                stats.inlined += master_spawn_counters[i]->inlined.load(::std::memory_order_relaxed);
+            }
+            return stats;
+        };
+
+
+        // Zero the counts. Call it while the pool is idle.
+        void reset_spawn_stats() {
+            for (auto i = 0; i < master_spawn_counters.size(); ++i) master_spawn_counters[i]->reset();
+        };
+
+
+        // Post a task. Fire and forget.
+        // No result state or receipt is made. An exception thrown by the task goes to the exception handler.
+        template<typename F, typename... A>
+        void post(F &&_func, A &&... args) {
+            grd_tp_info("I'll post a task");
+            enqueue(make_detached_task(juwhan::forward<F>(_func), juwhan::forward<A>(args)...));
+        };
+
         // Stop and go.
         void stop() {
             active.store(false);
@@ -272,30 +587,14 @@ namespace juwhan {
 
         void wait() {
             if (!tp) return;
-            grd_tp_info("I am a waiting thread. I will try to process pending tasks while waiting.");
-            while (!ret.is_set() && !tp->done) {
-                while (!ret.is_set() && tp->active && !tp->done) {
-                    auto fetched_task = tp->fetch_task();
-                    if (fetched_task) {
-                        grd_tp_info("I picked up a task while waiting for a function result to arrive.");
-                        (*fetched_task)();
-                        // Delete the done-with task.
-                        delete fetched_task;
-                    } else {
-                        this_thread::yield();
-                    }
-                }
-                // is_set has the upper most priority.
-                // if (tp->is_set()) break;
-                // Done is the second.
-                // if (tp->done) break;
-                // Someone stoppped the thread.
-                if (!ret.is_set() && !tp->done) {
-                    ::std::unique_lock<::std::mutex> lock{tp->mut};
-                    tp->cond.wait(lock, [this] { return (tp->active.load() || tp->done.load()); });
-                    lock.unlock();
-                }
-            } // Return value is set or the threadpool is done with.
+            tp->help_until([this] { return ret.is_set(); });
+        };
+
+        // Run func(result) on the pool once the result is set. Nobody waits in between.
+        // func takes nothing when T is void. See continuation.h.
+        template<typename F>
+        greedy_threadpool_receit<typename continuation_result<F, T>::type> then(F &&func_) {
+            return make_continuation(*tp, ret, ::juwhan::forward<F>(func_));
         };
     };
 
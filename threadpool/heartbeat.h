@@ -0,0 +1,79 @@
+#ifndef juwhan_heartbeat_h
+#define juwhan_heartbeat_h
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+
+#include "juwhan_std.h"
+#include "thread_task.h"
+
+#include "include_me.h"
+
+// This header file defines the latent tasks of the heartbeat mode of the pools.
+//
+// In heartbeat mode, submit does not push a task into the queue. The task is kept latent, in a list private to the submitting thread, and costs nothing more than the allocation.
+// A thread that waits on a receipt runs its latent tasks inline, newest first, as it would pop its own queue. So recursive code that waits on its children goes serial by default.
+// Every heartbeat interval, the thread promotes its oldest latent task into its queue, where thieves can take it. The oldest is the one nearest the root, and so usually the largest.
+// A thread checks for a due beat at a submit, and between tasks while it waits(help_until) or idles in the worker loop. A thread deep in a long task with no submit does not beat until it comes out.
+// A wait that does not run its own tasks(steal_until, as a channel does, and park_until, as a deep task_sync wait does) promotes all its latent tasks first, so the others can run them.
+// The cost of making stealable tasks is then bounded by one per interval per thread, whatever the cutoff of the recursion.
+//
+// Usage.
+//
+//     threadpool::instance.set_heartbeat(100);    // Microseconds. 0 turns it off.
+//     auto left = threadpool::instance.submit(fib, n - 1);   // Latent until a heartbeat promotes it.
+//     auto right = fib(n - 2);
+//     return left.get() + right;                  // Runs fib(n - 1) here, unless it was promoted.
+
+#define hb_info(...)
+#define hb_info_if(...)
+
+namespace juwhan {
+
+
+// The latent tasks of a thread. Only the owning thread touches them.
+    struct latent_tasks {
+        ::std::deque<thread_task *> tasks;
+        ::std::chrono::steady_clock::time_point last_beat;
+        // The number of tasks promoted so far. Written by the owning thread only, and read by anyone.
+        ::std::atomic<size_t> promoted;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+
+        latent_tasks() : tasks{}, last_beat{::std::chrono::steady_clock::now()}, promoted{0} {};
+
+        latent_tasks(latent_tasks &other) = delete;
+
+        latent_tasks &operator=(latent_tasks &other) = delete;
+
+        bool empty() const { return tasks.empty(); };
+
+        void push(thread_task *task) { tasks.push_back(task); };
+
+        // Take the newest task, or nullptr.
+        thread_task *pop() {
+            if (tasks.empty()) return nullptr;
+            auto task = tasks.back();
+            tasks.pop_back();
+            return task;
+        };
+
+        // Take the oldest task if a heartbeat is due, or nullptr.
+        // A beat with nothing latent is kept for the next check, so a long serial stretch is followed by a promotion right away.
+        thread_task *promote(::std::chrono::steady_clock::duration interval) {
+            if (tasks.empty()) return nullptr;
+            auto now = ::std::chrono::steady_clock::now();
+            if (now - last_beat < interval) return nullptr;
+            last_beat = now;
+            auto task = tasks.front();
+            tasks.pop_front();
+            promoted.fetch_add(1, ::std::memory_order_relaxed);
+            hb_info("A heartbeat. I will promote my oldest latent task.");
+            return task;
+        };
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
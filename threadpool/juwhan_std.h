@@ -609,6 +609,25 @@ struct enable_if<true, T> {
 };
 
 
+// Compile time integer sequences. C++14 provides these but C++11 does not.
+template<size_t... I>
+struct index_sequence {
+    static constexpr size_t
+    size = sizeof...(I);
+};
+template<size_t N, size_t... I>
+struct make_index_sequence_helper : make_index_sequence_helper<N - 1, N - 1, I...> {
+};
+template<size_t... I>
+struct make_index_sequence_helper<0, I...> {
+    using type = index_sequence<I...>;
+};
+template<size_t N>
+using make_index_sequence = typename make_index_sequence_helper<N>::type;
+template<typename... T>
+using index_sequence_for = make_index_sequence<sizeof...(T)>;
+
+
 template<typename T>
 class reference_wrapper {
     T *_ptr;
@@ -0,0 +1,197 @@
+#ifndef juwhan_parallel_algorithm_h
+#define juwhan_parallel_algorithm_h
+
+#include <atomic>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "juwhan_std.h"
+#include "parallel_for.h"
+#include "parallel_reduce.h"
+#include "parallel_scan.h"
+
+// This header file defines STL style algorithms that run on a pool.
+//
+// par(pool) makes a policy, and the policy goes first, in the place of the execution policies of the standard library.
+// All of them take random access iterators and run through parallel_for, parallel_reduce, or parallel_scan under the auto partitioner.
+// find_if and any_of stop early. Pieces past the first match found so far return without looking.
+// copy_if counts the matches per block, scans the counts, and then copies each block to its offset, so pred is called twice per element.
+//
+// Usage.
+//
+//     auto policy = par(threadpool::instance);
+//     transform(policy, in.begin(), in.end(), out.begin(), [](float x) { return x * x; });
+//     auto evens = count_if(policy, in.begin(), in.end(), [](int x) { return x % 2 == 0; });
+//     auto end = copy_if(policy, in.begin(), in.end(), out.begin(), [](int x) { return x > 0; });
+
+// How many elements find_if looks at between checks for an earlier match.
+#define JUWHAN_FIND_CHECK_INTERVAL 1024
+
+namespace juwhan {
+
+
+    template<typename TP>
+    struct parallel_policy {
+        TP &tp;
+
+        explicit parallel_policy(TP &tp_) : tp(tp_) {};
+    };
+
+
+// Make a policy that runs algorithms on the pool.
+    template<typename TP>
+    inline parallel_policy<TP> par(TP &tp) {
+        return parallel_policy<TP>{tp};
+    };
+
+
+// Call func on every element.
+    template<typename TP, typename I, typename F>
+    inline void for_each(parallel_policy<TP> policy, I first, I last, F func) {
+        size_t n = static_cast<size_t>(last - first);
+        parallel_for(policy.tp, blocked_range<size_t>{0, n}, [&](const blocked_range<size_t> &r) {
+            for (auto i = first + r.begin(); i != first + r.end(); ++i) func(*i);
+        });
+    };
+
+
+// out[i] = func(first[i]). Returns the end of the output.
+    template<typename TP, typename I, typename O, typename F>
+    inline O transform(parallel_policy<TP> policy, I first, I last, O out, F func) {
+        size_t n = static_cast<size_t>(last - first);
+        parallel_for(policy.tp, blocked_range<size_t>{0, n}, [&](const blocked_range<size_t> &r) {
+            auto o = out + r.begin();
+            for (auto i = first + r.begin(); i != first + r.end(); ++i, ++o) *o = func(*i);
+        });
+        return out + n;
+    };
+
+
+// out[i] = func(first1[i], first2[i]). Returns the end of the output.
+    template<typename TP, typename I1, typename I2, typename O, typename F>
+    inline O transform(parallel_policy<TP> policy, I1 first1, I1 last1, I2 first2, O out, F func) {
+        size_t n = static_cast<size_t>(last1 - first1);
+        parallel_for(policy.tp, blocked_range<size_t>{0, n}, [&](const blocked_range<size_t> &r) {
+            auto j = first2 + r.begin();
+            auto o = out + r.begin();
+            for (auto i = first1 + r.begin(); i != first1 + r.end(); ++i, ++j, ++o) *o = func(*i, *j);
+        });
+        return out + n;
+    };
+
+
+// Reduce func(first[i]) over the range with reduce, starting from init. reduce must be associative.
+    template<typename TP, typename I, typename T, typename R, typename F>
+    inline T transform_reduce(parallel_policy<TP> policy, I first, I last, T init, R reduce, F func) {
+        size_t n = static_cast<size_t>(last - first);
+        if (n == 0) return init;
+        // A partial result is empty until the first element of its piece seeds it, so that init is used exactly once.
+        using partial_type = ::std::pair<bool, T>;
+        auto partial = parallel_reduce(policy.tp, blocked_range<size_t>{0, n}, partial_type{false, init},
+                                       [&](const blocked_range<size_t> &r, partial_type value) {
+                                           auto i = first + r.begin();
+                                           if (!value.first) {
+                                               value.second = func(*i++);
+                                               value.first = true;
+                                           }
+                                           for (; i != first + r.end(); ++i) value.second = reduce(value.second, func(*i));
+                                           return value;
+                                       },
+                                       [&](const partial_type &a, const partial_type &b) {
+                                           if (!a.first) return b;
+                                           if (!b.first) return a;
+                                           return partial_type{true, reduce(a.second, b.second)};
+                                       });
+        return reduce(init, partial.second);
+    };
+
+
+// The number of elements that satisfy pred.
+    template<typename TP, typename I, typename P>
+    inline size_t count_if(parallel_policy<TP> policy, I first, I last, P pred) {
+        size_t n = static_cast<size_t>(last - first);
+        return parallel_reduce(policy.tp, blocked_range<size_t>{0, n}, size_t{0},
+                               [&](const blocked_range<size_t> &r, size_t count) {
+                                   for (auto i = first + r.begin(); i != first + r.end(); ++i) if (pred(*i)) ++count;
+                                   return count;
+                               },
+                               [](size_t a, size_t b) { return a + b; });
+    };
+
+
+// The first element that satisfies pred, or last.
+    template<typename TP, typename I, typename P>
+    inline I find_if(parallel_policy<TP> policy, I first, I last, P pred) {
+        size_t n = static_cast<size_t>(last - first);
+        // The lowest index found so far. Nothing at or past it needs to be looked at.
+        ::std::atomic<size_t> found{n};
+        parallel_for(policy.tp, blocked_range<size_t>{0, n}, [&](const blocked_range<size_t> &r) {
+            for (auto i = r.begin(); i < r.end(); ++i) {
+                if ((i - r.begin()) % JUWHAN_FIND_CHECK_INTERVAL == 0 && i >= found.load(::std::memory_order_relaxed)) return;
+                if (pred(*(first + i))) {
+                    auto current = found.load(::std::memory_order_relaxed);
+                    while (i < current && !found.compare_exchange_weak(current, i, ::std::memory_order_relaxed));
+                    return;
+                }
+            }
+        });
+        return first + found.load(::std::memory_order_relaxed);
+    };
+
+
+    template<typename TP, typename I, typename P>
+    inline bool any_of(parallel_policy<TP> policy, I first, I last, P pred) {
+        return find_if(policy, first, last, pred) != last;
+    };
+
+
+    template<typename TP, typename I, typename P>
+    inline bool none_of(parallel_policy<TP> policy, I first, I last, P pred) {
+        return find_if(policy, first, last, pred) == last;
+    };
+
+
+    template<typename TP, typename I, typename P>
+    inline bool all_of(parallel_policy<TP> policy, I first, I last, P pred) {
+        using reference = typename ::std::iterator_traits<I>::reference;
+        return find_if(policy, first, last, [&](reference x) { return !pred(x); }) == last;
+    };
+
+
+// Copy the elements that satisfy pred to out, keeping their order. Returns the end of the output.
+    template<typename TP, typename I, typename O, typename P>
+    inline O copy_if(parallel_policy<TP> policy, I first, I last, O out, P pred) {
+        auto &tp = policy.tp;
+        size_t n = static_cast<size_t>(last - first);
+        if (n == 0) return out;
+        size_t block_count = tp.thread_count() * JUWHAN_SCAN_BLOCKS_PER_WORKER;
+        size_t max_block_count = (n + JUWHAN_SCAN_MIN_BLOCK_SIZE - 1) / JUWHAN_SCAN_MIN_BLOCK_SIZE;
+        if (block_count > max_block_count) block_count = max_block_count;
+        size_t block_size = (n + block_count - 1) / block_count;
+        block_count = (n + block_size - 1) / block_size;
+        ::std::vector<size_t> offsets(block_count);
+        parallel_for(tp, blocked_range<size_t>{0, block_count}, [&](const blocked_range<size_t> &r) {
+            for (auto b = r.begin(); b != r.end(); ++b) {
+                auto e = (b + 1 == block_count) ? last : first + (b + 1) * block_size;
+                size_t count{0};
+                for (auto i = first + b * block_size; i != e; ++i) if (pred(*i)) ++count;
+                offsets[b] = count;
+            }
+        });
+        auto total = parallel_exclusive_scan(tp, offsets.begin(), offsets.end(), offsets.begin(), size_t{0},
+                                             [](size_t a, size_t b) { return a + b; });
+        parallel_for(tp, blocked_range<size_t>{0, block_count}, [&](const blocked_range<size_t> &r) {
+            for (auto b = r.begin(); b != r.end(); ++b) {
+                auto e = (b + 1 == block_count) ? last : first + (b + 1) * block_size;
+                auto o = out + offsets[b];
+                for (auto i = first + b * block_size; i != e; ++i) if (pred(*i)) *o++ = *i;
+            }
+        });
+        return out + total;
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
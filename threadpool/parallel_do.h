@@ -0,0 +1,141 @@
+#ifndef juwhan_parallel_do_h
+#define juwhan_parallel_do_h
+
+#include <atomic>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+#include "juwhan_std.h"
+#include "thread_task.h"
+#include "task_group.h"
+
+// This header file defines parallel_do, for work that is discovered as it is done.
+//
+// parallel_do(pool, first, last, body) calls body(item, feeder) on every item of [first, last), and on every item added through feeder.add() on the way, e.g. the children of a node in a tree traversal.
+// An item travels in a small record pushed straight into the queue of the thread that added it. There is no receipt and no result slot, and a record is not freed after it runs but kept on a free list of the thread that ran it, for the next add on that thread.
+// A single counter of the items not yet done tells when the whole thing is over. The caller helps the pool until it drops to zero.
+//
+// Usage.
+//
+//     parallel_do(threadpool::instance, roots.begin(), roots.end(), [&](node *n, parallel_do_feeder<threadpool, node *> &feeder) {
+//         visit(n);
+//         for (auto child : n->children) feeder.add(child);
+//     });
+
+#define pd_info(...)
+#define pd_info_if(...)
+
+namespace juwhan {
+
+
+    template<typename TP, typename T>
+    struct parallel_do_state;
+
+
+// Hands items discovered by the body back to parallel_do.
+    template<typename TP, typename T>
+    struct parallel_do_feeder {
+        parallel_do_state<TP, T> *state;
+
+        void add(const T &item) { state->add(item); };
+    };
+
+
+// The record of an item. It belongs to the parallel_do, not to the pool.
+    template<typename TP, typename T>
+    struct parallel_do_record : public thread_task {
+        T item;
+        parallel_do_state<TP, T> *state;
+
+        parallel_do_record(const T &item_, parallel_do_state<TP, T> *state_) : item(item_), state{state_} {};
+
+        void operator()() {
+            auto s = state;
+            if (!s->is_exceptional()) {
+                parallel_do_feeder<TP, T> feeder{s};
+                try { s->body(item, feeder); }
+                catch (::std::exception &e) { s->set_exception(e); }
+                catch (...) {
+                    ::std::runtime_error e{"A parallel_do body threw an exception that is not a ::std::exception."};
+                    s->set_exception(e);
+                }
+            }
+            // Back to the free list of this thread. Once the count drops, the state may be gone.
+            s->free_lists[s->tp.worker_index()].records.push_back(this);
+            s->pending.fetch_sub(1, ::std::memory_order_acq_rel);
+        };
+
+        bool is_pool_owned() const { return false; };
+    };
+
+
+// The free records of a thread. Only the thread itself touches them while parallel_do runs.
+    template<typename TP, typename T>
+    struct parallel_do_free_list {
+        ::std::vector<parallel_do_record<TP, T> *> records;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+    };
+
+
+    template<typename TP, typename T>
+    struct parallel_do_state : task_group_state {
+        using body_type = void (*)(void *, T &, parallel_do_feeder<TP, T> &);
+
+        TP &tp;
+        void *body_object;
+        body_type body_function;
+        ::std::vector<parallel_do_free_list<TP, T>> free_lists;
+
+        template<typename B>
+        static void call_body(void *body_object_, T &item, parallel_do_feeder<TP, T> &feeder) {
+            (*static_cast<const B *>(body_object_))(item, feeder);
+        };
+
+        template<typename B>
+        parallel_do_state(TP &tp_, const B &body_)
+                : task_group_state{}, tp(tp_), body_object{const_cast<B *>(&body_)}, body_function{&call_body<B>},
+                  free_lists(tp_.thread_count()) {};
+
+        ~parallel_do_state() {
+            for (auto &free_list : free_lists) for (auto record : free_list.records) delete record;
+        };
+
+        void body(T &item, parallel_do_feeder<TP, T> &feeder) { body_function(body_object, item, feeder); };
+
+        // Push an item into the queue of this thread, in a recycled record if there is one.
+        void add(const T &item) {
+            auto &records = free_lists[tp.worker_index()].records;
+            parallel_do_record<TP, T> *record;
+            if (records.empty()) {
+                record = new parallel_do_record<TP, T>{item, this};
+            } else {
+                record = records.back();
+                records.pop_back();
+                record->item = item;
+            }
+            pending.fetch_add(1, ::std::memory_order_relaxed);
+            tp.enqueue(record);
+        };
+    };
+
+
+// Call body(T &item, parallel_do_feeder<TP, T> &feeder) on every item of [first, last) and every item fed on the way, and return when all are done.
+// Once an exception is thrown, the bodies of the items still pending are skipped, and the first exception is rethrown as a runtime_error.
+    template<typename TP, typename I, typename B>
+    void parallel_do(TP &tp, I first, I last, const B &body) {
+        using item_type = typename ::std::iterator_traits<I>::value_type;
+        parallel_do_state<TP, item_type> state{tp, body};
+        for (auto i = first; i != last; ++i) state.add(*i);
+        if (!state.is_done()) {
+            pd_info("I fed the initial items. I will help until all items are done.");
+            auto s = &state;
+            tp.help_until([s] { return s->is_done(); });
+        }
+        if (state.is_exceptional()) throw ::std::runtime_error(state.exception_message);
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
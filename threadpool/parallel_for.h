@@ -0,0 +1,263 @@
+#ifndef juwhan_parallel_for_h
+#define juwhan_parallel_for_h
+
+#include <cstddef>
+#include <vector>
+
+#include "juwhan_std.h"
+#include "thread_task.h"
+#include "task_group.h"
+
+// This header file defines parallel_for over splittable ranges.
+//
+// A range is split in two, the upper half is spawned as a stack child into the caller's queue, and the lower half is processed in place, recursively. A partitioner decides when to stop splitting.
+//
+// static_partitioner: split up front into about one piece per worker, and never again.
+// simple_partitioner: split until the range is no longer divisible, i.e. down to its grain.
+// auto_partitioner: split a little up front, and split further only where thieves actually steal. A piece knows it was stolen when it runs on a queue other than the one it was spawned into.
+// affinity_partitioner: split up front into a fixed number of pieces, and remember which worker ran each. Passed again to a loop over the same range, it mails every piece to the worker that ran it last time, so the piece finds its data in that worker's cache. Idle workers still take mail sent to others, so stealing remains as a fallback.
+//
+// A partitioner is split along with the range, by a splitting constructor. The upper one spawns the upper piece, and is told when the piece starts.
+//
+// Usage.
+//
+//     parallel_for(threadpool::instance, blocked_range<size_t>{0, n}, [&](const blocked_range<size_t> &r) {
+//         for (auto i = r.begin(); i != r.end(); ++i) a[i] = f(b[i]);
+//     });
+//
+//     affinity_partitioner ap;    // Outlives the iterations.
+//     for (auto step = 0; step < steps; ++step) parallel_for(threadpool::instance, blocked_range<size_t>{0, n}, sweep, ap);
+
+#define pf_info(...)
+#define pf_info_if(...)
+
+namespace juwhan {
+
+
+// A tag for splitting constructors.
+    struct split {
+    };
+
+
+// A half-open range of integers or random access iterators. It is divisible while it is larger than its grain.
+    template<typename V>
+    struct blocked_range {
+        using value_type = V;
+        V first;
+        V last;
+        size_t grain;
+
+        blocked_range(V first_, V last_, size_t grain_ = 1) : first(first_), last(last_), grain{grain_ ? grain_ : 1} {};
+
+        // Take the upper half of other. other keeps the lower half.
+        blocked_range(blocked_range &other, split)
+                : first(other.first + (other.last - other.first) / 2), last(other.last), grain{other.grain} {
+            other.last = first;
+        };
+
+        V begin() const { return first; };
+
+        V end() const { return last; };
+
+        size_t size() const { return static_cast<size_t>(last - first); };
+
+        bool empty() const { return !(first < last); };
+
+        bool is_divisible() const { return size() > grain; };
+    };
+
+
+// Find the number of halvings that gives at least count pieces.
+    inline size_t split_depth_for(size_t count) {
+        size_t depth{0};
+        while ((size_t{1} << depth) < count) ++depth;
+        return depth;
+    };
+
+
+// What a partitioner does unless it says otherwise: spawn into my queue, and remember nothing.
+    struct partitioner_base {
+        template<typename G, typename C>
+        void spawn(G &group, C &child) { group.run(child); };
+
+        template<typename TP>
+        void note_start(TP &) {};
+    };
+
+
+    struct simple_partitioner : partitioner_base {
+        simple_partitioner() {};
+
+        simple_partitioner(simple_partitioner &, split) {};
+
+        void initialize(size_t) {};
+
+        template<typename R>
+        bool should_split(R &range, bool) { return range.is_divisible(); };
+    };
+
+
+    struct static_partitioner : partitioner_base {
+        size_t depth;
+
+        static_partitioner() : depth{0} {};
+
+        static_partitioner(static_partitioner &other, split) : depth{other.depth} {};
+
+        void initialize(size_t thread_count) { depth = split_depth_for(thread_count); };
+
+        template<typename R>
+        bool should_split(R &range, bool) {
+            if (depth == 0 || !range.is_divisible()) return false;
+            --depth;
+            return true;
+        };
+    };
+
+
+    struct auto_partitioner : partitioner_base {
+        size_t depth;
+
+        auto_partitioner() : depth{0} {};
+
+        auto_partitioner(auto_partitioner &other, split) : depth{other.depth} {};
+
+        // About two pieces per worker to start with.
+        void initialize(size_t thread_count) { depth = split_depth_for(thread_count) + 1; };
+
+        template<typename R>
+        bool should_split(R &range, bool is_stolen) {
+            if (!range.is_divisible()) return false;
+            // A stolen piece means there are idle workers. Give it more room to split, so the thief leaves work for others.
+            if (is_stolen) depth += 2;
+            if (depth == 0) return false;
+            --depth;
+            return true;
+        };
+    };
+
+
+// Keep one per loop, and pass the same object to every run of it. It may be copied, record and all.
+    struct affinity_partitioner {
+        // workers[id] is the worker that ran the piece id last time, or none. The pieces are numbered as in a binary heap, the whole range being 0.
+        ::std::vector<size_t> workers;
+        size_t depth;
+
+        static constexpr size_t none = static_cast<size_t>(-1);
+
+        affinity_partitioner() : workers{}, depth{0} {};
+
+        // About four pieces per worker. A different number of workers makes the record useless, so forget it.
+        void initialize(size_t thread_count) {
+            auto new_depth = split_depth_for(thread_count) + 2;
+            if (new_depth == depth && !workers.empty()) return;
+            depth = new_depth;
+            workers.assign(size_t{2} << depth, size_t{none});
+        };
+    };
+
+
+// The part of an affinity_partitioner each piece carries.
+    struct affinity_partition {
+        size_t *workers;
+        size_t id;
+        size_t depth;
+
+        explicit affinity_partition(affinity_partitioner &ap) : workers{ap.workers.data()}, id{0}, depth{ap.depth} {};
+
+        // Take the upper child of other. other becomes the lower one.
+        affinity_partition(affinity_partition &other, split) : workers{other.workers}, id{2 * other.id + 2}, depth{other.depth} {
+            other.id = 2 * other.id + 1;
+        };
+
+        // The pieces must be the same from run to run, so steals change nothing.
+        template<typename R>
+        bool should_split(R &range, bool) {
+            if (depth == 0 || !range.is_divisible()) return false;
+            --depth;
+            return true;
+        };
+
+        template<typename G, typename C>
+        void spawn(G &group, C &child) {
+            auto worker = workers[id];
+            if (worker != affinity_partitioner::none && worker != group.tp.worker_index() && worker < group.tp.thread_count()) {
+                pf_info("I will mail a piece of a parallel_for to " + to_string(worker) + ".");
+                group.mail(child, worker);
+            } else {
+                group.run(child);
+            }
+        };
+
+        template<typename TP>
+        void note_start(TP &tp) { workers[id] = tp.worker_index(); };
+    };
+
+
+    template<typename TP, typename R, typename B, typename P>
+    void parallel_for_range(TP &tp, R &range, const B &body, P &partitioner, bool is_stolen);
+
+
+// A piece of a parallel_for spawned as a stack child. It remembers the queue it was spawned into to tell a steal.
+    template<typename TP, typename R, typename B, typename P>
+    struct parallel_for_piece {
+        TP *tp;
+        R range;
+        const B *body;
+        P partitioner;
+        typename TP::queue_type_ptr origin;
+
+        void operator()() {
+            auto is_stolen = tp->my_queue.get() != origin;
+            pf_info_if(is_stolen, "A piece of a parallel_for has been stolen.");
+            partitioner.note_start(*tp);
+            parallel_for_range(*tp, range, *body, partitioner, is_stolen);
+        };
+    };
+
+
+    template<typename TP, typename R, typename B, typename P>
+    void parallel_for_range(TP &tp, R &range, const B &body, P &partitioner, bool is_stolen) {
+        if (!partitioner.should_split(range, is_stolen)) {
+            body(static_cast<const R &>(range));
+            return;
+        }
+        R upper{range, split{}};
+        P upper_partitioner{partitioner, split{}};
+        task_group<TP> group{tp};
+        auto child = group.make_child(parallel_for_piece<TP, R, B, P>{&tp, upper, &body, upper_partitioner, tp.my_queue.get()});
+        upper_partitioner.spawn(group, child);
+        parallel_for_range(tp, range, body, partitioner, false);
+        group.wait();
+    };
+
+
+// Apply body to disjoint subranges covering range, in parallel. body takes a const R&.
+// Exceptions from the calling thread's share propagate as is. Those from other pieces come back as a runtime_error.
+    template<typename TP, typename R, typename B, typename P>
+    inline void parallel_for(TP &tp, const R &range, const B &body, P partitioner) {
+        if (range.empty()) return;
+        partitioner.initialize(tp.thread_count());
+        R whole{range};
+        parallel_for_range(tp, whole, body, partitioner, false);
+    };
+
+// The same, sending the pieces to the workers that ran them the last time ap was used.
+    template<typename TP, typename R, typename B>
+    inline void parallel_for(TP &tp, const R &range, const B &body, affinity_partitioner &ap) {
+        if (range.empty()) return;
+        ap.initialize(tp.thread_count());
+        affinity_partition partitioner{ap};
+        R whole{range};
+        parallel_for_range(tp, whole, body, partitioner, false);
+    };
+
+    template<typename TP, typename R, typename B>
+    inline void parallel_for(TP &tp, const R &range, const B &body) {
+        parallel_for(tp, range, body, auto_partitioner{});
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
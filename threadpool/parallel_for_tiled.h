@@ -0,0 +1,193 @@
+#ifndef juwhan_parallel_for_tiled_h
+#define juwhan_parallel_for_tiled_h
+
+#include "juwhan_std.h"
+#include "parallel_for.h"
+
+// This header file defines two and three dimensional ranges, and a tiled parallel_for over two dimensional ones.
+//
+// blocked_range2d and blocked_range3d split along their longest dimension, measured in grains. They work with parallel_for as they are.
+// parallel_for_tiled cuts a blocked_range2d into tiles of its grains and calls the body once per tile. Within each piece the pool hands out, tiles are visited either row by row or in Morton(Z) order, by halving the longer side recursively, so that consecutive tiles stay close in both dimensions.
+// tile_side_for gives a tile side that keeps a square tile of some arrays within a cache. The cache sizes below are conservative defaults; define them before including this file to match the target.
+//
+// Usage.
+//
+//     auto side = tile_side_for(sizeof(float), 2);    // An input and an output tile in L1.
+//     parallel_for_tiled(threadpool::instance, blocked_range2d<size_t>{0, rows, side, 0, cols, side},
+//             [&](const blocked_range2d<size_t> &tile) {
+//                 for (auto i = tile.rows().begin(); i != tile.rows().end(); ++i)
+//                     for (auto j = tile.cols().begin(); j != tile.cols().end(); ++j) out[j * rows + i] = in[i * cols + j];
+//             });
+
+#ifndef JUWHAN_L1_CACHE_SIZE
+#define JUWHAN_L1_CACHE_SIZE 32768
+#endif
+#ifndef JUWHAN_L2_CACHE_SIZE
+#define JUWHAN_L2_CACHE_SIZE 262144
+#endif
+
+namespace juwhan {
+
+
+    template<typename R, typename C = R>
+    struct blocked_range2d {
+        blocked_range<R> row_range;
+        blocked_range<C> col_range;
+
+        blocked_range2d(R row_begin, R row_end, size_t row_grain, C col_begin, C col_end, size_t col_grain)
+                : row_range{row_begin, row_end, row_grain}, col_range{col_begin, col_end, col_grain} {};
+
+        blocked_range2d(R row_begin, R row_end, C col_begin, C col_end)
+                : row_range{row_begin, row_end}, col_range{col_begin, col_end} {};
+
+        blocked_range2d(const blocked_range<R> &row_range_, const blocked_range<C> &col_range_)
+                : row_range{row_range_}, col_range{col_range_} {};
+
+        // Take the upper half of other along its longer dimension, in grains.
+        blocked_range2d(blocked_range2d &other, split) : row_range{other.row_range}, col_range{other.col_range} {
+            if (other.split_rows()) row_range = blocked_range<R>{other.row_range, split{}};
+            else col_range = blocked_range<C>{other.col_range, split{}};
+        };
+
+        const blocked_range<R> &rows() const { return row_range; };
+
+        const blocked_range<C> &cols() const { return col_range; };
+
+        bool empty() const { return row_range.empty() || col_range.empty(); };
+
+        size_t size() const { return row_range.size() * col_range.size(); };
+
+        bool is_divisible() const { return row_range.is_divisible() || col_range.is_divisible(); };
+
+        bool split_rows() const {
+            if (!col_range.is_divisible()) return true;
+            if (!row_range.is_divisible()) return false;
+            return row_range.size() * col_range.grain >= col_range.size() * row_range.grain;
+        };
+    };
+
+
+    template<typename P, typename R = P, typename C = R>
+    struct blocked_range3d {
+        blocked_range<P> page_range;
+        blocked_range<R> row_range;
+        blocked_range<C> col_range;
+
+        blocked_range3d(P page_begin, P page_end, size_t page_grain, R row_begin, R row_end, size_t row_grain,
+                        C col_begin, C col_end, size_t col_grain)
+                : page_range{page_begin, page_end, page_grain}, row_range{row_begin, row_end, row_grain},
+                  col_range{col_begin, col_end, col_grain} {};
+
+        blocked_range3d(P page_begin, P page_end, R row_begin, R row_end, C col_begin, C col_end)
+                : page_range{page_begin, page_end}, row_range{row_begin, row_end}, col_range{col_begin, col_end} {};
+
+        // Take the upper half of other along its longest dimension, in grains.
+        blocked_range3d(blocked_range3d &other, split)
+                : page_range{other.page_range}, row_range{other.row_range}, col_range{other.col_range} {
+            auto pages = other.page_range.is_divisible() ? other.page_range.size() / other.page_range.grain : 0;
+            auto rows = other.row_range.is_divisible() ? other.row_range.size() / other.row_range.grain : 0;
+            auto cols = other.col_range.is_divisible() ? other.col_range.size() / other.col_range.grain : 0;
+            if (pages >= rows && pages >= cols && pages > 0) page_range = blocked_range<P>{other.page_range, split{}};
+            else if (rows >= cols && rows > 0) row_range = blocked_range<R>{other.row_range, split{}};
+            else col_range = blocked_range<C>{other.col_range, split{}};
+        };
+
+        const blocked_range<P> &pages() const { return page_range; };
+
+        const blocked_range<R> &rows() const { return row_range; };
+
+        const blocked_range<C> &cols() const { return col_range; };
+
+        bool empty() const { return page_range.empty() || row_range.empty() || col_range.empty(); };
+
+        size_t size() const { return page_range.size() * row_range.size() * col_range.size(); };
+
+        bool is_divisible() const {
+            return page_range.is_divisible() || row_range.is_divisible() || col_range.is_divisible();
+        };
+    };
+
+
+// The side of a square tile of elements that fits arrays times in a cache. A power of two, and at least a cache line of elements.
+    inline size_t tile_side_for(size_t element_size, size_t arrays = 1, size_t cache_size = JUWHAN_L1_CACHE_SIZE) {
+        size_t minimum = JUWHAN_CACHELINE_SIZE / element_size ? JUWHAN_CACHELINE_SIZE / element_size : 1;
+        size_t side{1};
+        while ((2 * side) * (2 * side) * element_size * arrays <= cache_size) side *= 2;
+        return side < minimum ? minimum : side;
+    };
+
+
+    enum struct tile_order {
+        row_major,
+        morton
+    };
+
+
+// Visit the tiles [row_first, row_last) x [col_first, col_last) of range in Morton order, halving the longer side.
+    template<typename R, typename C, typename B>
+    void visit_tiles_morton(const blocked_range2d<R, C> &range, size_t row_first, size_t row_last,
+                            size_t col_first, size_t col_last, const B &body) {
+        auto rows = row_last - row_first;
+        auto cols = col_last - col_first;
+        if (rows == 1 && cols == 1) {
+            auto row_grain = range.row_range.grain;
+            auto col_grain = range.col_range.grain;
+            auto row_begin = range.row_range.first + row_first * row_grain;
+            auto col_begin = range.col_range.first + col_first * col_grain;
+            auto row_end = (row_first + 1) * row_grain < range.row_range.size() ? row_begin + row_grain : range.row_range.last;
+            auto col_end = (col_first + 1) * col_grain < range.col_range.size() ? col_begin + col_grain : range.col_range.last;
+            body(blocked_range2d<R, C>{row_begin, row_end, row_grain, col_begin, col_end, col_grain});
+            return;
+        }
+        if (rows >= cols) {
+            auto middle = row_first + rows / 2;
+            visit_tiles_morton(range, row_first, middle, col_first, col_last, body);
+            visit_tiles_morton(range, middle, row_last, col_first, col_last, body);
+        } else {
+            auto middle = col_first + cols / 2;
+            visit_tiles_morton(range, row_first, row_last, col_first, middle, body);
+            visit_tiles_morton(range, row_first, row_last, middle, col_last, body);
+        }
+    };
+
+
+// Visit the tiles of range, each of at most its grains, in the given order.
+    template<typename R, typename C, typename B>
+    void visit_tiles(const blocked_range2d<R, C> &range, tile_order order, const B &body) {
+        if (range.empty()) return;
+        auto row_grain = range.row_range.grain;
+        auto col_grain = range.col_range.grain;
+        size_t row_tiles = (range.row_range.size() + row_grain - 1) / row_grain;
+        size_t col_tiles = (range.col_range.size() + col_grain - 1) / col_grain;
+        if (order == tile_order::morton) {
+            visit_tiles_morton(range, 0, row_tiles, 0, col_tiles, body);
+            return;
+        }
+        for (auto i = range.row_range.first; i < range.row_range.last; i += row_grain) {
+            auto row_end = range.row_range.last - i > row_grain ? i + row_grain : range.row_range.last;
+            for (auto j = range.col_range.first; j < range.col_range.last; j += col_grain) {
+                auto col_end = range.col_range.last - j > col_grain ? j + col_grain : range.col_range.last;
+                body(blocked_range2d<R, C>{i, row_end, row_grain, j, col_end, col_grain});
+            }
+        }
+    };
+
+
+// Call body once per tile of range. A tile is at most the range's grains in each dimension.
+// Pieces are split off along the longer dimension under the partitioner, and the tiles of each piece are visited in order.
+    template<typename TP, typename R, typename C, typename B, typename P>
+    inline void parallel_for_tiled(TP &tp, const blocked_range2d<R, C> &range, const B &body, tile_order order,
+                                   P partitioner) {
+        parallel_for(tp, range, [&](const blocked_range2d<R, C> &piece) { visit_tiles(piece, order, body); }, partitioner);
+    };
+
+    template<typename TP, typename R, typename C, typename B>
+    inline void parallel_for_tiled(TP &tp, const blocked_range2d<R, C> &range, const B &body,
+                                   tile_order order = tile_order::morton) {
+        parallel_for_tiled(tp, range, body, order, auto_partitioner{});
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
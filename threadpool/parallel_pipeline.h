@@ -0,0 +1,411 @@
+#ifndef juwhan_parallel_pipeline_h
+#define juwhan_parallel_pipeline_h
+
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "juwhan_std.h"
+#include "thread_task.h"
+#include "task_group.h"
+
+// This header file defines parallel_pipeline, a chain of filters run over a stream of items on a pool.
+//
+// A filter is made by make_filter<In, Out>(mode, func), and filters are chained with operator&, the output type of one being the input type of the next.
+// The first filter takes a flow_control and makes items until it calls stop(). The last one takes items and returns nothing.
+//
+// filter_mode::parallel: any number of items at a time.
+// filter_mode::serial_out_of_order: one item at a time, in any order.
+// filter_mode::serial_in_order: one item at a time, in the order the first filter made them. The first filter is always serial.
+//
+// An item travels in a token, and a token is carried through all the filters by one thread, from one filter to the next, so the item stays in one cache.
+// A token that finds a serial filter busy, or not yet at its turn, waits there. The thread leaving the filter spawns the token that gets it next, and carries its own on.
+// A thread done with the last filter goes back to the first one for a new item. While tokens are left over, every item read also spawns a task to read the next, which other workers steal.
+// There are at most max_tokens tokens, so at most max_tokens items are alive at a time.
+//
+// Usage.
+//
+//     parallel_pipeline(threadpool::instance, 16,
+//             make_filter<void, line *>(filter_mode::serial_in_order, [&](flow_control &fc) -> line * {
+//                 if (in.eof()) { fc.stop(); return nullptr; }
+//                 return read_line(in);
+//             }),
+//             make_filter<line *, record>(filter_mode::parallel, [](line *l) { return parse(l); }),
+//             make_filter<record, void>(filter_mode::serial_in_order, [&](record r) { write(out, r); }));
+
+#define pp_info(...)
+#define pp_info_if(...)
+
+namespace juwhan {
+
+
+    enum struct filter_mode {
+        parallel,
+        serial_out_of_order,
+        serial_in_order
+    };
+
+
+// Handed to the first filter. Calling stop() ends the stream, and what the filter returns with it is dropped.
+    struct flow_control {
+        bool is_stopped;
+
+        flow_control() : is_stopped{false} {};
+
+        void stop() { is_stopped = true; };
+    };
+
+
+    struct pipeline_token {
+        void *item;
+        size_t sequence;
+    };
+
+
+// A filter, its type erased. Items are passed between filters as pointers to heap objects of the filters' types.
+// A serial filter also keeps the tokens waiting for it: in a ring indexed by sequence when in order, and first come first served otherwise.
+    struct pipeline_stage {
+        filter_mode mode;
+        size_t references;
+        ::std::mutex mut;
+        bool is_busy;
+        size_t next_sequence;
+        ::std::vector<pipeline_token *> ordered;
+        ::std::deque<pipeline_token *> unordered;
+
+        explicit pipeline_stage(filter_mode mode_)
+                : mode{mode_}, references{0}, mut{}, is_busy{false}, next_sequence{0}, ordered{}, unordered{} {};
+
+        virtual ~pipeline_stage() {};
+
+        // Turn the input into the output, deleting the input. The output is nullptr when the filter returns nothing.
+        virtual void *run(void *item, flow_control &fc) = 0;
+
+        // Delete an input without running the filter.
+        virtual void discard(void *item) = 0;
+
+        bool is_serial() const { return mode != filter_mode::parallel; };
+
+        // Get ready for a run of a pipeline.
+        void reset(size_t max_tokens) {
+            is_busy = false;
+            next_sequence = 0;
+            ordered.assign(max_tokens, nullptr);
+            unordered.clear();
+        };
+
+        // Take the filter for token, or leave token waiting for it.
+        // In order, the tokens waiting are all within max_tokens of next_sequence, since all those in between are alive. So their places in the ring never collide.
+        bool acquire(pipeline_token *token) {
+            ::std::lock_guard<::std::mutex> lg{mut};
+            if (!is_busy && (mode == filter_mode::serial_out_of_order || token->sequence == next_sequence)) {
+                is_busy = true;
+                return true;
+            }
+            if (mode == filter_mode::serial_in_order) ordered[token->sequence % ordered.size()] = token;
+            else unordered.push_back(token);
+            return false;
+        };
+
+        // Give up the filter, and return the waiting token that takes it over, if any.
+        pipeline_token *release() {
+            ::std::lock_guard<::std::mutex> lg{mut};
+            ++next_sequence;
+            pipeline_token *next{nullptr};
+            if (mode == filter_mode::serial_in_order) {
+                auto &slot = ordered[next_sequence % ordered.size()];
+                if (slot && slot->sequence == next_sequence) {
+                    next = slot;
+                    slot = nullptr;
+                }
+            } else if (!unordered.empty()) {
+                next = unordered.front();
+                unordered.pop_front();
+            }
+            if (!next) is_busy = false;
+            return next;
+        };
+    };
+
+
+// How a filter of each kind is called.
+    template<typename In, typename Out>
+    struct pipeline_call {
+        template<typename F>
+        static void *call(F &func, void *item, flow_control &) {
+            auto input = static_cast<In *>(item);
+            Out *output;
+            try { output = new Out(func(::juwhan::move(*input))); }
+            catch (...) {
+                delete input;
+                throw;
+            }
+            delete input;
+            return output;
+        };
+
+        static void discard(void *item) { delete static_cast<In *>(item); };
+    };
+
+    template<typename In>
+    struct pipeline_call<In, void> {
+        template<typename F>
+        static void *call(F &func, void *item, flow_control &) {
+            auto input = static_cast<In *>(item);
+            try { func(::juwhan::move(*input)); }
+            catch (...) {
+                delete input;
+                throw;
+            }
+            delete input;
+            return nullptr;
+        };
+
+        static void discard(void *item) { delete static_cast<In *>(item); };
+    };
+
+    template<typename Out>
+    struct pipeline_call<void, Out> {
+        template<typename F>
+        static void *call(F &func, void *, flow_control &fc) { return new Out(func(fc)); };
+
+        static void discard(void *) {};
+    };
+
+    template<>
+    struct pipeline_call<void, void> {
+        template<typename F>
+        static void *call(F &func, void *, flow_control &fc) {
+            func(fc);
+            return nullptr;
+        };
+
+        static void discard(void *) {};
+    };
+
+
+    template<typename In, typename Out, typename F>
+    struct pipeline_stage_implementation : public pipeline_stage {
+        F func;
+
+        template<typename FF>
+        pipeline_stage_implementation(filter_mode mode_, FF &&func_) : pipeline_stage{mode_}, func(::juwhan::forward<FF>(func_)) {};
+
+        void *run(void *item, flow_control &fc) { return pipeline_call<In, Out>::call(func, item, fc); };
+
+        void discard(void *item) { pipeline_call<In, Out>::discard(item); };
+    };
+
+
+// A chain of filters from In to Out. Copies share the filters.
+    template<typename In, typename Out>
+    struct filter {
+        ::std::vector<pipeline_stage *> stages;
+
+        explicit filter(pipeline_stage *stage) : stages{} {
+            stages.push_back(stage);
+            ++stage->references;
+        };
+
+        filter(const ::std::vector<pipeline_stage *> &stages_) : stages{stages_} {
+            for (auto stage : stages) ++stage->references;
+        };
+
+        filter(const filter &other) : filter{other.stages} {};
+
+        filter &operator=(const filter &other) = delete;
+
+        ~filter() {
+            for (auto stage : stages) if (--stage->references == 0) delete stage;
+        };
+    };
+
+
+    template<typename In, typename Out, typename F>
+    inline filter<In, Out> make_filter(filter_mode mode, F &&func) {
+        return filter<In, Out>{new pipeline_stage_implementation<In, Out, typename decay<F>::type>{mode, ::juwhan::forward<F>(func)}};
+    };
+
+
+// Chain two filters.
+    template<typename A, typename B, typename C>
+    inline filter<A, C> operator&(const filter<A, B> &first, const filter<B, C> &second) {
+        auto stages = first.stages;
+        stages.insert(stages.end(), second.stages.begin(), second.stages.end());
+        return filter<A, C>{stages};
+    };
+
+
+    template<typename TP>
+    struct pipeline_state;
+
+
+// A task carrying a token from a filter on, or reading a new item when token is nullptr.
+    template<typename TP>
+    struct pipeline_task : public thread_task {
+        pipeline_state<TP> *state;
+        pipeline_token *token;
+        size_t stage;
+
+        pipeline_task(pipeline_state<TP> *state_, pipeline_token *token_, size_t stage_)
+                : state{state_}, token{token_}, stage{stage_} {};
+
+        void operator()() {
+            auto s = state;
+            s->work(token, stage);
+            // The pool deletes this task, and the state may be gone once the count drops.
+            s->pending.fetch_sub(1, ::std::memory_order_acq_rel);
+        };
+    };
+
+
+    template<typename TP>
+    struct pipeline_state : task_group_state {
+        TP &tp;
+        const ::std::vector<pipeline_stage *> &stages;
+        ::std::mutex input_mut;
+        bool is_reading;
+        bool is_stopped;
+        size_t next_sequence;
+        ::std::vector<pipeline_token> tokens;
+        ::std::vector<pipeline_token *> free_tokens;
+
+        pipeline_state(TP &tp_, const ::std::vector<pipeline_stage *> &stages_, size_t max_tokens)
+                : task_group_state{}, tp(tp_), stages(stages_), input_mut{}, is_reading{false}, is_stopped{false},
+                  next_sequence{0}, tokens(max_tokens), free_tokens{} {
+            for (auto &token : tokens) free_tokens.push_back(&token);
+            for (auto stage : stages) stage->reset(max_tokens);
+        };
+
+        // A token at a filter that holds the filter already.
+        void spawn(pipeline_token *token, size_t stage) {
+            pending.fetch_add(1, ::std::memory_order_relaxed);
+            tp.enqueue(new pipeline_task<TP>{this, token, stage});
+        };
+
+        // Read an item into a free token, unless someone else is reading, the stream is over, or no token is free.
+        pipeline_token *read() {
+            pipeline_token *token;
+            {
+                ::std::lock_guard<::std::mutex> lg{input_mut};
+                if (is_stopped || is_reading || free_tokens.empty()) return nullptr;
+                is_reading = true;
+                token = free_tokens.back();
+                free_tokens.pop_back();
+            }
+            flow_control fc;
+            void *item{nullptr};
+            if (is_exceptional()) fc.stop();
+            else {
+                try { item = stages[0]->run(nullptr, fc); }
+                catch (::std::exception &e) {
+                    set_exception(e);
+                    fc.stop();
+                }
+                catch (...) {
+                    ::std::runtime_error e{"A filter threw an exception that is not a ::std::exception."};
+                    set_exception(e);
+                    fc.stop();
+                }
+            }
+            bool is_spare;
+            {
+                ::std::lock_guard<::std::mutex> lg{input_mut};
+                is_reading = false;
+                if (fc.is_stopped) {
+                    pp_info("The stream is over.");
+                    is_stopped = true;
+                    free_tokens.push_back(token);
+                    if (item) stages[1]->discard(item);
+                    return nullptr;
+                }
+                token->item = item;
+                token->sequence = next_sequence++;
+                is_spare = !free_tokens.empty();
+            }
+            // Let another worker read the next item while this one carries its own.
+            if (is_spare) spawn(nullptr, 0);
+            return token;
+        };
+
+        // Carry token through the filters from stage on. False if it was left waiting at a serial filter.
+        // The filter at stage is held already when the token was handed over by release.
+        bool carry(pipeline_token *token, size_t stage, bool is_held) {
+            flow_control fc;
+            for (; stage < stages.size(); ++stage, is_held = false) {
+                auto current = stages[stage];
+                if (current->is_serial() && !is_held && !current->acquire(token)) return false;
+                // After an exception, the tokens still pass every filter, in order, but the filters are not run.
+                if (is_exceptional()) {
+                    current->discard(token->item);
+                    token->item = nullptr;
+                } else {
+                    try { token->item = current->run(token->item, fc); }
+                    catch (::std::exception &e) {
+                        set_exception(e);
+                        token->item = nullptr;
+                    }
+                    catch (...) {
+                        // The item is gone, so the filters after this one must not run on it.
+                        ::std::runtime_error e{"A filter threw an exception that is not a ::std::exception."};
+                        set_exception(e);
+                        token->item = nullptr;
+                    }
+                }
+                if (current->is_serial()) {
+                    if (auto next = current->release()) spawn(next, stage);
+                }
+            }
+            return true;
+        };
+
+        // Carry a token on, if any, and then read and carry new items until there is nothing to do.
+        void work(pipeline_token *token, size_t stage) {
+            bool is_held = token != nullptr;
+            for (;;) {
+                if (!token) {
+                    token = read();
+                    if (!token) return;
+                    stage = 1;
+                    is_held = false;
+                }
+                if (!carry(token, stage, is_held)) return;
+                {
+                    ::std::lock_guard<::std::mutex> lg{input_mut};
+                    free_tokens.push_back(token);
+                }
+                token = nullptr;
+            }
+        };
+    };
+
+
+// Run the chain of filters from void to void until its first filter stops, with at most max_tokens items alive at a time.
+// After an exception, no more items are read, and the first exception is rethrown as a runtime_error once all tokens are back.
+    template<typename TP>
+    void parallel_pipeline(TP &tp, size_t max_tokens, const filter<void, void> &chain) {
+        if (max_tokens == 0) throw ::std::runtime_error("A pipeline needs at least one token.");
+        pipeline_state<TP> state{tp, chain.stages, max_tokens};
+        state.work(nullptr, 0);
+        if (!state.is_done()) {
+            pp_info("I am out of items to carry. I will help until all tokens are back.");
+            auto s = &state;
+            tp.help_until([s] { return s->is_done(); });
+        }
+        if (state.is_exceptional()) throw ::std::runtime_error(state.exception_message);
+    };
+
+// The same with the filters given one by one.
+    template<typename TP, typename A, typename B, typename C, typename... F>
+    inline void parallel_pipeline(TP &tp, size_t max_tokens, const filter<A, B> &first, const filter<B, C> &second,
+                                  const F &... rest) {
+        parallel_pipeline(tp, max_tokens, first & second, rest...);
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef juwhan_parallel_radix_sort_h
+#define juwhan_parallel_radix_sort_h
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "juwhan_std.h"
+#include "parallel_for.h"
+#include "parallel_scan.h"
+
+// This header file defines a parallel LSD radix sort for unsigned integer keys, with an optional value per key.
+//
+// Each pass sorts by one 8 bit digit, from the least significant up, ping-ponging between the range and a buffer:
+// 1. The range is cut into one block per worker, and each block counts its digits into its own histogram.
+// 2. The histograms, laid out digit by digit, go through parallel_exclusive_scan and become the write offsets of each digit of each block.
+// 3. Each block scatters its keys. Keys are staged per digit in a cache line sized write-combining buffer and written out a full line at a time, instead of one scattered store per key.
+// A pass whose digit is the same for all keys is skipped. Every pass is stable, and so is the sort.
+//
+// The ranges must be contiguous(arrays, vectors).
+//
+// Usage.
+//
+//     parallel_radix_sort(threadpool::instance, keys.begin(), keys.end());
+//     parallel_radix_sort(threadpool::instance, keys.begin(), keys.end(), values.begin());   // values follow their keys.
+
+// The number of bits sorted per pass.
+#define JUWHAN_RADIX_BITS 8
+// Blocks smaller than this are not worth a task.
+#define JUWHAN_RADIX_MIN_BLOCK_SIZE 65536
+
+#define rs_info(...)
+#define rs_info_if(...)
+
+namespace juwhan {
+
+
+    namespace radix_detail {
+
+
+        static constexpr size_t radix_size = size_t{1} << JUWHAN_RADIX_BITS;
+        static constexpr size_t radix_mask = radix_size - 1;
+
+
+        // The value type of a sort without values.
+        struct no_value {
+        };
+
+
+        // Scatter [begin, end) of a block by the digit at shift, starting at the block's offsets.
+        template<typename K, typename V, bool H>
+        void scatter_block(const K *keys, K *key_out, const V *values, V *value_out, size_t begin, size_t end,
+                           size_t shift, size_t *offsets) {
+            // One cache line of keys per digit.
+            static constexpr size_t line_size = JUWHAN_CACHELINE_SIZE / sizeof(K) ? JUWHAN_CACHELINE_SIZE / sizeof(K) : 1;
+            K key_lines[radix_size][line_size];
+            ::std::vector<V> value_lines(H ? radix_size * line_size : 0);
+            size_t fill[radix_size] = {0};
+            for (auto i = begin; i < end; ++i) {
+                auto digit = static_cast<size_t>(keys[i] >> shift) & radix_mask;
+                auto f = fill[digit];
+                key_lines[digit][f] = keys[i];
+                if (H) value_lines[digit * line_size + f] = values[i];
+                if (++f == line_size) {
+                    // The line is full. Write it out in one go.
+                    ::std::copy(key_lines[digit], key_lines[digit] + line_size, key_out + offsets[digit]);
+                    if (H)
+                        ::std::copy(value_lines.begin() + digit * line_size, value_lines.begin() + (digit + 1) * line_size,
+                                    value_out + offsets[digit]);
+                    offsets[digit] += line_size;
+                    f = 0;
+                }
+                fill[digit] = f;
+            }
+            // Write out what is left in the lines.
+            for (size_t digit = 0; digit < radix_size; ++digit) {
+                ::std::copy(key_lines[digit], key_lines[digit] + fill[digit], key_out + offsets[digit]);
+                if (H)
+                    ::std::copy(value_lines.begin() + digit * line_size, value_lines.begin() + digit * line_size + fill[digit],
+                                value_out + offsets[digit]);
+            }
+        };
+
+
+        template<typename TP, typename K, typename V, bool H>
+        void radix_sort(TP &tp, K *keys, V *values, size_t n) {
+            static_assert(is_integral<K>::value && K(-1) > K(0), "Radix sort keys must be unsigned integers.");
+            ::std::vector<K> key_buffer(n);
+            ::std::vector<V> value_buffer(H ? n : 0);
+            K *key_source = keys;
+            K *key_target = key_buffer.data();
+            V *value_source = values;
+            V *value_target = value_buffer.data();
+            size_t block_count = (n + JUWHAN_RADIX_MIN_BLOCK_SIZE - 1) / JUWHAN_RADIX_MIN_BLOCK_SIZE;
+            if (block_count > tp.thread_count()) block_count = tp.thread_count();
+            size_t block_size = (n + block_count - 1) / block_count;
+            block_count = (n + block_size - 1) / block_size;
+            // counts[digit * block_count + block]. Scanned in this order, it gives each block its offset within each digit.
+            ::std::vector<size_t> counts(radix_size * block_count);
+            for (size_t shift = 0; shift < 8 * sizeof(K); shift += JUWHAN_RADIX_BITS) {
+                // 1. Per block histograms.
+                parallel_for(tp, blocked_range<size_t>{0, block_count}, [&](const blocked_range<size_t> &r) {
+                    for (auto b = r.begin(); b != r.end(); ++b) {
+                        size_t histogram[radix_size] = {0};
+                        auto end = ::std::min(n, (b + 1) * block_size);
+                        for (auto i = b * block_size; i < end; ++i)
+                            ++histogram[static_cast<size_t>(key_source[i] >> shift) & radix_mask];
+                        for (size_t digit = 0; digit < radix_size; ++digit) counts[digit * block_count + b] = histogram[digit];
+                    }
+                }, static_partitioner{});
+                // Skip the pass if all keys have the same digit.
+                bool is_uniform{false};
+                for (size_t digit = 0; digit < radix_size && !is_uniform; ++digit) {
+                    size_t total{0};
+                    for (size_t b = 0; b < block_count; ++b) total += counts[digit * block_count + b];
+                    if (total == n) is_uniform = true;
+                }
+                if (is_uniform) {
+                    rs_info("All keys share the digit at " + to_string(shift) + ". I will skip the pass.");
+                    continue;
+                }
+                // 2. Offsets.
+                parallel_exclusive_scan(tp, counts.begin(), counts.end(), counts.begin(), size_t{0},
+                                        ::std::plus<size_t>{});
+                // 3. Scatter.
+                parallel_for(tp, blocked_range<size_t>{0, block_count}, [&](const blocked_range<size_t> &r) {
+                    for (auto b = r.begin(); b != r.end(); ++b) {
+                        size_t offsets[radix_size];
+                        for (size_t digit = 0; digit < radix_size; ++digit) offsets[digit] = counts[digit * block_count + b];
+                        scatter_block<K, V, H>(key_source, key_target, value_source, value_target,
+                                               b * block_size, ::std::min(n, (b + 1) * block_size), shift, offsets);
+                    }
+                }, static_partitioner{});
+                ::std::swap(key_source, key_target);
+                ::std::swap(value_source, value_target);
+            }
+            // An odd number of passes leaves the result in the buffer.
+            if (key_source != keys) {
+                parallel_for(tp, blocked_range<size_t>{0, n, JUWHAN_RADIX_MIN_BLOCK_SIZE}, [&](const blocked_range<size_t> &r) {
+                    ::std::copy(key_source + r.begin(), key_source + r.end(), keys + r.begin());
+                    if (H) ::std::copy(value_source + r.begin(), value_source + r.end(), values + r.begin());
+                });
+            }
+        };
+
+
+    } // End of namespace radix_detail.
+
+
+// Sort the unsigned integer keys in [first, last) in ascending order.
+    template<typename TP, typename I>
+    inline void parallel_radix_sort(TP &tp, I first, I last) {
+        using key_type = typename remove_cv<typename remove_reference<decltype(*first)>::type>::type;
+        size_t n = static_cast<size_t>(last - first);
+        if (n < 2) return;
+        radix_detail::radix_sort<TP, key_type, radix_detail::no_value, false>(tp, &*first, nullptr, n);
+    };
+
+
+// Sort the unsigned integer keys in [first, last) in ascending order, moving the value at the same position of values along with each key.
+// Keys that are equal keep their order.
+    template<typename TP, typename I, typename J>
+    inline void parallel_radix_sort(TP &tp, I first, I last, J values) {
+        using key_type = typename remove_cv<typename remove_reference<decltype(*first)>::type>::type;
+        using value_type = typename remove_cv<typename remove_reference<decltype(*values)>::type>::type;
+        size_t n = static_cast<size_t>(last - first);
+        if (n < 2) return;
+        radix_detail::radix_sort<TP, key_type, value_type, true>(tp, &*first, &*values, n);
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef juwhan_parallel_reduce_h
+#define juwhan_parallel_reduce_h
+
+#include "juwhan_std.h"
+#include "thread_task.h"
+#include "task_group.h"
+#include "parallel_for.h"
+
+// This header file defines parallel_reduce over splittable ranges.
+//
+// The range is split the same way parallel_for splits it, under the same partitioners. Every split leaves a partial result in the splitting frame, and the two halves are combined there, lower half first.
+// So the combination follows the fork-join tree, combine need not be commutative, and nothing is shared between workers but the stack children.
+//
+// Usage.
+//
+//     auto sum = parallel_reduce(threadpool::instance, blocked_range<size_t>{0, n}, 0.0,
+//             [&](const blocked_range<size_t> &r, double partial) {
+//                 for (auto i = r.begin(); i != r.end(); ++i) partial += a[i];
+//                 return partial;
+//             },
+//             [](double x, double y) { return x + y; });
+
+#define pr_info(...)
+#define pr_info_if(...)
+
+namespace juwhan {
+
+
+    template<typename TP, typename R, typename T, typename B, typename C, typename P>
+    T parallel_reduce_range(TP &tp, R &range, const T &identity, const B &body, const C &combine, P &partitioner,
+                            bool is_stolen);
+
+
+// A piece of a parallel_reduce spawned as a stack child. It leaves its result in the parent's frame.
+    template<typename TP, typename R, typename T, typename B, typename C, typename P>
+    struct parallel_reduce_piece {
+        TP *tp;
+        R range;
+        const T *identity;
+        const B *body;
+        const C *combine;
+        P partitioner;
+        typename TP::queue_type_ptr origin;
+        T *result;
+
+        void operator()() {
+            auto is_stolen = tp->my_queue.get() != origin;
+            partitioner.note_start(*tp);
+            *result = parallel_reduce_range(*tp, range, *identity, *body, *combine, partitioner, is_stolen);
+        };
+    };
+
+
+    template<typename TP, typename R, typename T, typename B, typename C, typename P>
+    T parallel_reduce_range(TP &tp, R &range, const T &identity, const B &body, const C &combine, P &partitioner,
+                            bool is_stolen) {
+        if (!partitioner.should_split(range, is_stolen)) return body(static_cast<const R &>(range), identity);
+        R upper{range, split{}};
+        P upper_partitioner{partitioner, split{}};
+        T upper_result(identity);
+        task_group<TP> group{tp};
+        auto child = group.make_child(parallel_reduce_piece<TP, R, T, B, C, P>{
+                &tp, upper, &identity, &body, &combine, upper_partitioner, tp.my_queue.get(), &upper_result});
+        upper_partitioner.spawn(group, child);
+        T lower_result = parallel_reduce_range(tp, range, identity, body, combine, partitioner, false);
+        group.wait();
+        return combine(lower_result, upper_result);
+    };
+
+
+// Reduce range in parallel. body(const R&, T partial) folds a subrange into partial and returns it; combine(T, T) joins two partials.
+// Exceptions from the calling thread's share propagate as is. Those from other pieces come back as a runtime_error.
+    template<typename TP, typename R, typename T, typename B, typename C, typename P>
+    inline T parallel_reduce(TP &tp, const R &range, const T &identity, const B &body, const C &combine, P partitioner) {
+        if (range.empty()) return identity;
+        partitioner.initialize(tp.thread_count());
+        R whole{range};
+        return parallel_reduce_range(tp, whole, identity, body, combine, partitioner, false);
+    };
+
+// The same, sending the pieces to the workers that ran them the last time ap was used.
+    template<typename TP, typename R, typename T, typename B, typename C>
+    inline T parallel_reduce(TP &tp, const R &range, const T &identity, const B &body, const C &combine,
+                             affinity_partitioner &ap) {
+        if (range.empty()) return identity;
+        ap.initialize(tp.thread_count());
+        affinity_partition partitioner{ap};
+        R whole{range};
+        return parallel_reduce_range(tp, whole, identity, body, combine, partitioner, false);
+    };
+
+    template<typename TP, typename R, typename T, typename B, typename C>
+    inline T parallel_reduce(TP &tp, const R &range, const T &identity, const B &body, const C &combine) {
+        return parallel_reduce(tp, range, identity, body, combine, auto_partitioner{});
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
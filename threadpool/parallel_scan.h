@@ -0,0 +1,107 @@
+#ifndef juwhan_parallel_scan_h
+#define juwhan_parallel_scan_h
+
+#include <vector>
+
+#include "juwhan_std.h"
+#include "parallel_for.h"
+
+// This header file defines parallel prefix scans over random access ranges.
+//
+// The scan is done in two passes over a fixed set of blocks, a few per worker:
+// 1. Each block is reduced to its sum, in parallel.
+// 2. The block sums are scanned serially. There are only a few of them.
+// 3. Each block is scanned again, in parallel, starting from its offset.
+// Every element is read twice and written once, as in the serial scan plus a reduction. The block loops run under the given partitioner.
+//
+// out may be the same as first.
+//
+// Usage.
+//
+//     // offsets[i] = counts[0] + ... + counts[i - 1]. total = counts[0] + ... + counts[n - 1].
+//     auto total = parallel_exclusive_scan(threadpool::instance, counts.begin(), counts.end(), offsets.begin(), size_t{0},
+//             [](size_t a, size_t b) { return a + b; });
+
+// Blocks smaller than this are not worth a task.
+#define JUWHAN_SCAN_MIN_BLOCK_SIZE 4096
+// Blocks per worker, to leave some room for balancing.
+#define JUWHAN_SCAN_BLOCKS_PER_WORKER 4
+
+
+namespace juwhan {
+
+
+    template<typename TP, typename I, typename O, typename T, typename F, typename P>
+    T parallel_scan(TP &tp, I first, I last, O out, const T &identity, const F &op, P partitioner, bool is_inclusive) {
+        size_t n = static_cast<size_t>(last - first);
+        if (n == 0) return identity;
+        size_t block_count = tp.thread_count() * JUWHAN_SCAN_BLOCKS_PER_WORKER;
+        size_t max_block_count = (n + JUWHAN_SCAN_MIN_BLOCK_SIZE - 1) / JUWHAN_SCAN_MIN_BLOCK_SIZE;
+        if (block_count > max_block_count) block_count = max_block_count;
+        size_t block_size = (n + block_count - 1) / block_count;
+        block_count = (n + block_size - 1) / block_size;
+        // Pass 1. Reduce each block.
+        ::std::vector<T> offsets(block_count + 1, identity);
+        parallel_for(tp, blocked_range<size_t>{0, block_count}, [&](const blocked_range<size_t> &r) {
+            for (auto b = r.begin(); b != r.end(); ++b) {
+                auto i = first + b * block_size;
+                auto e = (b + 1 == block_count) ? last : i + block_size;
+                T sum(identity);
+                for (; i != e; ++i) sum = op(sum, *i);
+                offsets[b + 1] = sum;
+            }
+        }, partitioner);
+        // Scan block sums.
+        for (size_t b = 0; b < block_count; ++b) offsets[b + 1] = op(offsets[b], offsets[b + 1]);
+        // Pass 2. Scan each block from its offset.
+        parallel_for(tp, blocked_range<size_t>{0, block_count}, [&](const blocked_range<size_t> &r) {
+            for (auto b = r.begin(); b != r.end(); ++b) {
+                auto i = first + b * block_size;
+                auto e = (b + 1 == block_count) ? last : i + block_size;
+                auto o = out + b * block_size;
+                T sum(offsets[b]);
+                if (is_inclusive) {
+                    for (; i != e; ++i, ++o) {
+                        sum = op(sum, *i);
+                        *o = sum;
+                    }
+                } else {
+                    for (; i != e; ++i, ++o) {
+                        T value(*i);
+                        *o = sum;
+                        sum = op(sum, value);
+                    }
+                }
+            }
+        }, partitioner);
+        return offsets[block_count];
+    };
+
+
+// out[i] = identity op first[0] op ... op first[i]. Returns the total.
+    template<typename TP, typename I, typename O, typename T, typename F, typename P>
+    inline T parallel_inclusive_scan(TP &tp, I first, I last, O out, const T &identity, const F &op, P partitioner) {
+        return parallel_scan(tp, first, last, out, identity, op, partitioner, true);
+    };
+
+    template<typename TP, typename I, typename O, typename T, typename F>
+    inline T parallel_inclusive_scan(TP &tp, I first, I last, O out, const T &identity, const F &op) {
+        return parallel_scan(tp, first, last, out, identity, op, auto_partitioner{}, true);
+    };
+
+
+// out[i] = identity op first[0] op ... op first[i - 1]. Returns the total.
+    template<typename TP, typename I, typename O, typename T, typename F, typename P>
+    inline T parallel_exclusive_scan(TP &tp, I first, I last, O out, const T &identity, const F &op, P partitioner) {
+        return parallel_scan(tp, first, last, out, identity, op, partitioner, false);
+    };
+
+    template<typename TP, typename I, typename O, typename T, typename F>
+    inline T parallel_exclusive_scan(TP &tp, I first, I last, O out, const T &identity, const F &op) {
+        return parallel_scan(tp, first, last, out, identity, op, auto_partitioner{}, false);
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef juwhan_parallel_select_h
+#define juwhan_parallel_select_h
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+#include "juwhan_std.h"
+#include "parallel_for.h"
+#include "parallel_sort.h"
+#include "combinable.h"
+
+// This header file defines parallel selection: nth_element, partial_sort, and top_k.
+//
+// parallel_nth_element: a quickselect. Each round takes a ninther as the pivot, partitions(in parallel through a buffer for large ranges, as parallel_sort does), and keeps only the side holding nth. Small ranges finish with ::std::nth_element.
+// parallel_partial_sort: parallel_nth_element for the boundary, then parallel_sort of the front only.
+// parallel_top_k: leaves the input alone. Every worker keeps a heap of the best k elements it has seen, and the heaps are merged at the end.
+//
+// Usage.
+//
+//     parallel_nth_element(threadpool::instance, v.begin(), v.begin() + v.size() / 2, v.end());    // The median.
+//     std::vector<int> best(100);
+//     parallel_top_k(threadpool::instance, v.begin(), v.end(), 100, best.begin());                  // The largest 100, largest first.
+
+#define sel_info(...)
+#define sel_info_if(...)
+
+namespace juwhan {
+
+
+// Rearrange [first, last) so that nth holds what it would hold if sorted by comp, nothing before it is greater, and nothing after it is less.
+    template<typename TP, typename I, typename C>
+    void parallel_nth_element(TP &tp, I first, I nth, I last, C comp) {
+        using value_type = typename ::std::iterator_traits<I>::value_type;
+        if (nth == last) return;
+        size_t n = static_cast<size_t>(last - first);
+        ::std::vector<value_type> buffer;
+        if (n >= JUWHAN_SORT_PARALLEL_PARTITION_SIZE && tp.thread_count() > 1) buffer.resize(n);
+        auto origin = first;
+        auto depth_limit = sort_detail::depth_limit_for(n);
+        while (last - first > JUWHAN_SORT_SERIAL_SIZE && depth_limit > 0) {
+            --depth_limit;
+            sort_detail::choose_pivot(first, last, comp);
+            I cut;
+            bool is_left_sorted{false};
+            if (!buffer.empty() && last - first >= JUWHAN_SORT_PARALLEL_PARTITION_SIZE) {
+                cut = sort_detail::parallel_partition(tp, first, last, buffer.begin() + (first - origin), comp, is_left_sorted);
+            } else {
+                cut = sort_detail::unguarded_partition(first, last, comp);
+            }
+            if (nth < cut) {
+                // Everything on the left equals the pivot. nth is already in place.
+                if (is_left_sorted) return;
+                last = cut;
+            } else {
+                first = cut;
+            }
+        }
+        sel_info("A selection narrowed down to " + to_string(last - first) + " elements. I will finish it serially.");
+        ::std::nth_element(first, nth, last, comp);
+    };
+
+    template<typename TP, typename I>
+    inline void parallel_nth_element(TP &tp, I first, I nth, I last) {
+        parallel_nth_element(tp, first, nth, last, ::std::less<typename ::std::iterator_traits<I>::value_type>{});
+    };
+
+
+// Rearrange [first, last) so that [first, middle) holds the smallest elements by comp, sorted. The order of the rest is unspecified.
+    template<typename TP, typename I, typename C>
+    void parallel_partial_sort(TP &tp, I first, I middle, I last, C comp) {
+        if (first == middle) return;
+        if (middle != last) parallel_nth_element(tp, first, middle - 1, last, comp);
+        parallel_sort(tp, first, middle, comp);
+    };
+
+    template<typename TP, typename I>
+    inline void parallel_partial_sort(TP &tp, I first, I middle, I last) {
+        parallel_partial_sort(tp, first, middle, last, ::std::less<typename ::std::iterator_traits<I>::value_type>{});
+    };
+
+
+// Copy the first k elements of [first, last) as if it were sorted by comp into out, in that order, and return the end of the output.
+// The input is not modified. The default comp is greater, which gives the k largest, largest first.
+    template<typename TP, typename I, typename O, typename C>
+    O parallel_top_k(TP &tp, I first, I last, size_t k, O out, C comp) {
+        using value_type = typename ::std::iterator_traits<I>::value_type;
+        size_t n = static_cast<size_t>(last - first);
+        if (k > n) k = n;
+        if (k == 0) return out;
+        // The front of each heap is the worst element it keeps.
+        combinable<TP, ::std::vector<value_type>> heaps{tp};
+        parallel_for(tp, blocked_range<size_t>{0, n, JUWHAN_SORT_SERIAL_SIZE}, [&](const blocked_range<size_t> &r) {
+            auto &heap = heaps.local();
+            if (heap.capacity() < k) heap.reserve(k);
+            for (auto i = first + r.begin(); i != first + r.end(); ++i) {
+                if (heap.size() < k) {
+                    heap.push_back(*i);
+                    ::std::push_heap(heap.begin(), heap.end(), comp);
+                } else if (comp(*i, heap.front())) {
+                    ::std::pop_heap(heap.begin(), heap.end(), comp);
+                    heap.back() = *i;
+                    ::std::push_heap(heap.begin(), heap.end(), comp);
+                }
+            }
+        });
+        // Merge the heaps.
+        ::std::vector<value_type> candidates;
+        heaps.combine_each([&](::std::vector<value_type> &heap) {
+            candidates.insert(candidates.end(), heap.begin(), heap.end());
+        });
+        ::std::partial_sort(candidates.begin(), candidates.begin() + k, candidates.end(), comp);
+        return ::std::copy(candidates.begin(), candidates.begin() + k, out);
+    };
+
+    template<typename TP, typename I, typename O>
+    inline O parallel_top_k(TP &tp, I first, I last, size_t k, O out) {
+        return parallel_top_k(tp, first, last, k, out, ::std::greater<typename ::std::iterator_traits<I>::value_type>{});
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
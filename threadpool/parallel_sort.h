@@ -0,0 +1,315 @@
+#ifndef juwhan_parallel_sort_h
+#define juwhan_parallel_sort_h
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+#include "juwhan_std.h"
+#include "task_group.h"
+#include "parallel_for.h"
+
+// This header file defines parallel comparison sorts over random access ranges.
+//
+// parallel_sort: an introsort. Pivots are the median of three, or a ninther on larger ranges. Recursion deeper than 2*log2(n) falls back to heap sort, and short ranges are insertion sorted.
+// The two sides of a partition are sorted in parallel as stack children. The top levels, where a serial partition would leave the other workers idle, partition in parallel through a buffer.
+// parallel_stable_sort: a merge sort that ping-pongs between the range and a buffer. Large merges are cut along the merge path into equal pieces, which are merged in parallel.
+//
+// Both allocate one buffer of the range's size(parallel_sort only for large ranges), so the value type must be default constructible.
+//
+// Usage.
+//
+//     parallel_sort(threadpool::instance, v.begin(), v.end());
+//     parallel_stable_sort(threadpool::instance, records.begin(), records.end(), [](const record &a, const record &b) { return a.key < b.key; });
+
+// Ranges up to this size are insertion sorted.
+#define JUWHAN_SORT_INSERTION_SIZE 16
+// Ranges up to this size are sorted serially.
+#define JUWHAN_SORT_SERIAL_SIZE 4096
+// Ranges from this size on are partitioned in parallel.
+#define JUWHAN_SORT_PARALLEL_PARTITION_SIZE (1 << 17)
+// Ranges from this size on take a ninther for a pivot.
+#define JUWHAN_SORT_NINTHER_SIZE 128
+// The output size of a piece of a parallel merge.
+#define JUWHAN_MERGE_PIECE_SIZE 8192
+
+#define ps_info(...)
+#define ps_info_if(...)
+
+namespace juwhan {
+
+
+    namespace sort_detail {
+
+
+        template<typename I, typename C>
+        inline void insertion_sort(I first, I last, C &comp) {
+            if (first == last) return;
+            for (auto i = first + 1; i != last; ++i) {
+                auto value = ::juwhan::move(*i);
+                auto j = i;
+                for (; j != first && comp(value, *(j - 1)); --j) *j = ::juwhan::move(*(j - 1));
+                *j = ::juwhan::move(value);
+            }
+        };
+
+
+        // Order three elements.
+        template<typename I, typename C>
+        inline void sort3(I a, I b, I c, C &comp) {
+            if (comp(*b, *a)) ::std::iter_swap(a, b);
+            if (comp(*c, *b)) ::std::iter_swap(b, c);
+            if (comp(*b, *a)) ::std::iter_swap(a, b);
+        };
+
+
+        // Put the pivot at first. Both ends of the range are left as sentinels for unguarded_partition.
+        template<typename I, typename C>
+        inline void choose_pivot(I first, I last, C &comp) {
+            auto n = last - first;
+            auto middle = first + n / 2;
+            if (n >= JUWHAN_SORT_NINTHER_SIZE) {
+                sort3(first, middle, last - 1, comp);
+                sort3(first + 1, middle - 1, last - 2, comp);
+                sort3(first + 2, middle + 1, last - 3, comp);
+                sort3(middle - 1, middle, middle + 1, comp);
+                ::std::iter_swap(first, middle);
+            } else {
+                sort3(middle, first, last - 1, comp);
+            }
+        };
+
+
+        // Partition [first + 1, last) around *first. Returns the cut; [first, cut) is not greater and [cut, last) is not less than the pivot.
+        template<typename I, typename C>
+        inline I unguarded_partition(I first, I last, C &comp) {
+            auto pivot = first;
+            ++first;
+            while (true) {
+                while (comp(*first, *pivot)) ++first;
+                --last;
+                while (comp(*pivot, *last)) --last;
+                if (!(first < last)) return first;
+                ::std::iter_swap(first, last);
+                ++first;
+            }
+        };
+
+
+        inline size_t depth_limit_for(size_t n) {
+            size_t depth{0};
+            while (n > 1) {
+                n >>= 1;
+                ++depth;
+            }
+            return 2 * depth;
+        };
+
+
+        // Partition a large range in parallel around the value at first, through the buffer at b.
+        // Blocks count their elements less than the pivot, the counts are scanned, and each block scatters its elements into the buffer at its offsets. Then the buffer is moved back.
+        // When nothing is less than the pivot, the elements equal to it are split off instead, and is_left_sorted is raised.
+        template<typename TP, typename I, typename B, typename C>
+        I parallel_partition(TP &tp, I first, I last, B b, C &comp, bool &is_left_sorted) {
+            using value_type = typename ::std::iterator_traits<I>::value_type;
+            size_t n = static_cast<size_t>(last - first);
+            value_type pivot(*first);
+            size_t block_count = tp.thread_count() * 4;
+            size_t block_size = (n + block_count - 1) / block_count;
+            block_count = (n + block_size - 1) / block_size;
+            ::std::vector<size_t> left_offsets(block_count + 1, 0);
+            is_left_sorted = false;
+            auto is_left = [&](const value_type &x) {
+                return is_left_sorted ? !comp(pivot, x) : comp(x, pivot);
+            };
+            for (auto attempt = 0; attempt < 2; ++attempt) {
+                parallel_for(tp, blocked_range<size_t>{0, block_count}, [&](const blocked_range<size_t> &r) {
+                    for (auto k = r.begin(); k != r.end(); ++k) {
+                        auto i = first + k * block_size;
+                        auto e = (k + 1 == block_count) ? last : i + block_size;
+                        size_t count{0};
+                        for (; i != e; ++i) if (is_left(*i)) ++count;
+                        left_offsets[k + 1] = count;
+                    }
+                });
+                for (size_t k = 0; k < block_count; ++k) left_offsets[k + 1] += left_offsets[k];
+                if (left_offsets[block_count] > 0) break;
+                is_left_sorted = true;
+            }
+            size_t left_count = left_offsets[block_count];
+            ps_info("A parallel partition splits " + to_string(n) + " elements at " + to_string(left_count) + ".");
+            parallel_for(tp, blocked_range<size_t>{0, block_count}, [&](const blocked_range<size_t> &r) {
+                for (auto k = r.begin(); k != r.end(); ++k) {
+                    auto i = first + k * block_size;
+                    auto e = (k + 1 == block_count) ? last : i + block_size;
+                    auto left = b + left_offsets[k];
+                    auto right = b + left_count + (k * block_size - left_offsets[k]);
+                    for (; i != e; ++i) {
+                        if (is_left(*i)) *left++ = ::juwhan::move(*i);
+                        else *right++ = ::juwhan::move(*i);
+                    }
+                }
+            });
+            parallel_for(tp, blocked_range<size_t>{0, n, JUWHAN_SORT_SERIAL_SIZE}, [&](const blocked_range<size_t> &r) {
+                ::std::move(b + r.begin(), b + r.end(), first + r.begin());
+            });
+            return first + left_count;
+        };
+
+
+        // buffer holds as many elements as the range starting at origin, or is null. Large partitions go through it in parallel.
+        template<typename TP, typename I, typename V, typename C>
+        void introsort(TP &tp, I first, I last, I origin, V *buffer, C &comp, size_t depth_limit) {
+            while (last - first > JUWHAN_SORT_INSERTION_SIZE) {
+                if (depth_limit == 0) {
+                    ps_info("A sort went too deep. I will fall back to heap sort.");
+                    ::std::make_heap(first, last, comp);
+                    ::std::sort_heap(first, last, comp);
+                    return;
+                }
+                --depth_limit;
+                choose_pivot(first, last, comp);
+                I cut;
+                bool is_left_sorted{false};
+                if (buffer && last - first >= JUWHAN_SORT_PARALLEL_PARTITION_SIZE) {
+                    cut = parallel_partition(tp, first, last, buffer + (first - origin), comp, is_left_sorted);
+                } else {
+                    cut = unguarded_partition(first, last, comp);
+                }
+                if (is_left_sorted) {
+                    first = cut;
+                    continue;
+                }
+                if (cut - first > JUWHAN_SORT_SERIAL_SIZE && last - cut > JUWHAN_SORT_SERIAL_SIZE) {
+                    // Both sides are worth a task. Spawn the upper one and sort the lower one here.
+                    task_group<TP> group{tp};
+                    auto child = group.make_child([&tp, cut, last, origin, buffer, &comp, depth_limit] {
+                        introsort(tp, cut, last, origin, buffer, comp, depth_limit);
+                    });
+                    group.run(child);
+                    introsort(tp, first, cut, origin, buffer, comp, depth_limit);
+                    group.wait();
+                    return;
+                }
+                // Recurse into the smaller side, loop on the larger.
+                if (cut - first < last - cut) {
+                    introsort(tp, first, cut, origin, buffer, comp, depth_limit);
+                    first = cut;
+                } else {
+                    introsort(tp, cut, last, origin, buffer, comp, depth_limit);
+                    last = cut;
+                }
+            }
+            insertion_sort(first, last, comp);
+        };
+
+
+        // The number of elements of a that precede the d-th output of a stable merge of a and b.
+        template<typename I, typename C>
+        inline size_t merge_path_split(I a, size_t na, I b, size_t nb, size_t d, C &comp) {
+            size_t low = d > nb ? d - nb : 0;
+            size_t high = d < na ? d : na;
+            while (low < high) {
+                size_t middle = low + (high - low) / 2;
+                if (comp(*(b + (d - middle - 1)), *(a + middle))) high = middle;
+                else low = middle + 1;
+            }
+            return low;
+        };
+
+
+        // Stable merge of [a, a + na) and [b, b + nb) into out, moving elements.
+        template<typename TP, typename I, typename O, typename C>
+        void parallel_merge(TP &tp, I a, size_t na, I b, size_t nb, O out, C &comp) {
+            size_t n = na + nb;
+            if (n < 2 * JUWHAN_MERGE_PIECE_SIZE) {
+                ::std::merge(::std::make_move_iterator(a), ::std::make_move_iterator(a + na),
+                             ::std::make_move_iterator(b), ::std::make_move_iterator(b + nb), out, comp);
+                return;
+            }
+            size_t piece_count = (n + JUWHAN_MERGE_PIECE_SIZE - 1) / JUWHAN_MERGE_PIECE_SIZE;
+            parallel_for(tp, blocked_range<size_t>{0, piece_count}, [&](const blocked_range<size_t> &r) {
+                for (auto p = r.begin(); p != r.end(); ++p) {
+                    size_t d0 = n * p / piece_count;
+                    size_t d1 = n * (p + 1) / piece_count;
+                    size_t i0 = merge_path_split(a, na, b, nb, d0, comp);
+                    size_t i1 = merge_path_split(a, na, b, nb, d1, comp);
+                    ::std::merge(::std::make_move_iterator(a + i0), ::std::make_move_iterator(a + i1),
+                                 ::std::make_move_iterator(b + (d0 - i0)), ::std::make_move_iterator(b + (d1 - i1)),
+                                 out + d0, comp);
+                }
+            });
+        };
+
+
+        // Sort [first, first + n) stably. The result goes to the buffer if to_buffer, or stays in place otherwise.
+        template<typename TP, typename I, typename B, typename C>
+        void merge_sort(TP &tp, I first, B b, size_t n, bool to_buffer, C &comp) {
+            if (n <= JUWHAN_SORT_INSERTION_SIZE) {
+                insertion_sort(first, first + n, comp);
+                if (to_buffer) ::std::move(first, first + n, b);
+                return;
+            }
+            size_t half = n / 2;
+            // Sort the halves into the other array, then merge them back into the target.
+            if (n > JUWHAN_SORT_SERIAL_SIZE) {
+                task_group<TP> group{tp};
+                auto child = group.make_child([&tp, first, b, half, n, to_buffer, &comp] {
+                    merge_sort(tp, first + half, b + half, n - half, !to_buffer, comp);
+                });
+                group.run(child);
+                merge_sort(tp, first, b, half, !to_buffer, comp);
+                group.wait();
+            } else {
+                merge_sort(tp, first, b, half, !to_buffer, comp);
+                merge_sort(tp, first + half, b + half, n - half, !to_buffer, comp);
+            }
+            if (to_buffer) parallel_merge(tp, first, half, first + half, n - half, b, comp);
+            else parallel_merge(tp, b, half, b + half, n - half, first, comp);
+        };
+
+
+    } // End of namespace sort_detail.
+
+
+// Sort [first, last) by comp, in parallel. Not stable.
+    template<typename TP, typename I, typename C>
+    void parallel_sort(TP &tp, I first, I last, C comp) {
+        using value_type = typename ::std::iterator_traits<I>::value_type;
+        size_t n = static_cast<size_t>(last - first);
+        if (n < 2) return;
+        if (n >= JUWHAN_SORT_PARALLEL_PARTITION_SIZE && tp.thread_count() > 1) {
+            ::std::vector<value_type> buffer(n);
+            sort_detail::introsort(tp, first, last, first, buffer.data(), comp, sort_detail::depth_limit_for(n));
+        } else {
+            sort_detail::introsort(tp, first, last, first, static_cast<value_type *>(nullptr), comp,
+                                   sort_detail::depth_limit_for(n));
+        }
+    };
+
+    template<typename TP, typename I>
+    inline void parallel_sort(TP &tp, I first, I last) {
+        parallel_sort(tp, first, last, ::std::less<typename ::std::iterator_traits<I>::value_type>{});
+    };
+
+
+// Sort [first, last) by comp, in parallel, keeping equal elements in their order.
+    template<typename TP, typename I, typename C>
+    void parallel_stable_sort(TP &tp, I first, I last, C comp) {
+        using value_type = typename ::std::iterator_traits<I>::value_type;
+        size_t n = static_cast<size_t>(last - first);
+        if (n < 2) return;
+        ::std::vector<value_type> buffer(n);
+        sort_detail::merge_sort(tp, first, buffer.begin(), n, false, comp);
+    };
+
+    template<typename TP, typename I>
+    inline void parallel_stable_sort(TP &tp, I first, I last) {
+        parallel_stable_sort(tp, first, last, ::std::less<typename ::std::iterator_traits<I>::value_type>{});
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
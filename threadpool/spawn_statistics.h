@@ -0,0 +1,64 @@
+#ifndef juwhan_spawn_statistics_h
+#define juwhan_spawn_statistics_h
+
+#include <atomic>
+
+#include "juwhan_std.h"
+
+#include "include_me.h"
+
+// This header file defines the counters behind spawn_or_run of the pools.
+//
+// spawn_or_run(f, args...) is submit(f, args...) that may run f in place. When the queue of the calling thread already holds more than the inline threshold, and no idle worker has raised its demand flag(see demand_flag.h), spawning more only adds to a queue nobody is taking from.
+// f is then called right away and the receipt comes back already set. Nothing goes through the queue, and the task itself is not allocated.
+// So recursive code can call spawn_or_run at every level, without a hand-picked cutoff.
+//
+// Usage.
+//
+//     threadpool::instance.set_inline_threshold(8);
+//     auto left = threadpool::instance.spawn_or_run(fib, n - 1);
+//     ...
+//     auto stats = threadpool::instance.spawn_stats();   // How many were spawned and how many run in place.
+
+// The default inline threshold, in tasks in the calling thread's queue.
+#ifndef JUWHAN_INLINE_THRESHOLD
+#define JUWHAN_INLINE_THRESHOLD 16
+#endif
+
+namespace juwhan {
+
+
+// The counts of one thread. Only the thread itself writes them, so there is no read-modify-write.
+    struct spawn_counters {
+        ::std::atomic<size_t> spawned;
+        ::std::atomic<size_t> inlined;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+
+        spawn_counters() : spawned{0}, inlined{0} {};
+
+        spawn_counters(spawn_counters &other) = delete;
+
+        spawn_counters &operator=(spawn_counters &other) = delete;
+
+        void count_spawned() { spawned.store(spawned.load(::std::memory_order_relaxed) + 1, ::std::memory_order_relaxed); };
+
+        void count_inlined() { inlined.store(inlined.load(::std::memory_order_relaxed) + 1, ::std::memory_order_relaxed); };
+
+        void reset() {
+            spawned.store(0, ::std::memory_order_relaxed);
+            inlined.store(0, ::std::memory_order_relaxed);
+        };
+    };
+
+
+// What spawn_or_run has done over all threads of a pool.
+    struct spawn_statistics {
+        size_t spawned;
+        size_t inlined;
+        size_t inline_threshold;
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef juwhan_splittable_task_h
+#define juwhan_splittable_task_h
+
+#include "juwhan_std.h"
+#include "thread_task.h"
+#include "task_group.h"
+#include "parallel_for.h"
+
+// This header file defines lazy task creation: tasks that split only when someone asks for work.
+//
+// parallel_for spawns pieces up front, whether or not anyone is there to take them. A splittable task instead runs as one task, a step at a time, and between steps looks at the demand flag of the worker running it.
+// A thief that finds nothing to steal raises the flags of the other workers(see demand_flag.h). Only then does the task split off part of its remaining work, as a stack child into the worker's queue, where the thief can steal it. The child is itself a splittable task.
+// When all workers are busy, no flag is raised, and no task is created at all.
+//
+// A splittable task S provides
+//
+//     bool empty() const;             // Nothing left to do.
+//     void step();                    // Do a bounded slice of the remaining work.
+//     bool is_divisible() const;      // There is enough left to give some away.
+//     S(S &other, split);             // The split hook. Take part of the remaining work of other, as ranges do.
+//
+// Usage.
+//
+//     lazy_parallel_for(threadpool::instance, blocked_range<size_t>{0, n, 1024}, [&](const blocked_range<size_t> &r) {
+//         for (auto i = r.begin(); i != r.end(); ++i) a[i] = f(b[i]);
+//     });
+
+#define st_info(...)
+#define st_info_if(...)
+
+namespace juwhan {
+
+
+    template<typename TP, typename S>
+    void run_splittable(TP &tp, S &task);
+
+
+// The part of a splittable task given away, spawned as a stack child.
+    template<typename TP, typename S>
+    struct splittable_piece {
+        TP *tp;
+        S task;
+
+        void operator()() { run_splittable(*tp, task); };
+    };
+
+
+// Run task to the end in this thread, splitting off work whenever this worker's demand flag was raised.
+    template<typename TP, typename S>
+    void run_splittable(TP &tp, S &task) {
+        // A task does not move between threads while it runs, so the flag is looked up once.
+        auto &demand = tp.my_demand_flag();
+        while (!task.empty()) {
+            if (demand.take() && task.is_divisible()) {
+                st_info("Someone is hungry. I will split off a part of my task.");
+                S other{task, split{}};
+                task_group<TP> group{tp};
+                auto child = group.make_child(splittable_piece<TP, S>{&tp, ::juwhan::move(other)});
+                group.run(child);
+                // Go on with the rest in a new frame, which may split again.
+                run_splittable(tp, task);
+                group.wait();
+                return;
+            }
+            task.step();
+        }
+    };
+
+
+// A splittable task over a blocked_range. A step is one grain.
+    template<typename V, typename B>
+    struct lazy_range_task {
+        blocked_range<V> range;
+        const B *body;
+
+        lazy_range_task(const blocked_range<V> &range_, const B *body_) : range{range_}, body{body_} {};
+
+        // Take the upper half of what other has left.
+        lazy_range_task(lazy_range_task &other, split) : range{other.range, split{}}, body{other.body} {};
+
+        bool empty() const { return range.empty(); };
+
+        bool is_divisible() const { return range.is_divisible(); };
+
+        void step() {
+            auto end = range.is_divisible() ? range.first + range.grain : range.last;
+            (*body)(blocked_range<V>{range.first, end, range.grain});
+            range.first = end;
+        };
+    };
+
+
+// Apply body to disjoint subranges of at most a grain covering range, splitting only on demand. body takes a const blocked_range<V>&.
+// The grain is also how often the demand flag is looked at, so it should be a few microseconds of work.
+// Exceptions from the calling thread's share propagate as is. Those from other pieces come back as a runtime_error.
+    template<typename TP, typename V, typename B>
+    inline void lazy_parallel_for(TP &tp, const blocked_range<V> &range, const B &body) {
+        lazy_range_task<V, B> task{range, &body};
+        run_splittable(tp, task);
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef juwhan_static_task_graph_h
+#define juwhan_static_task_graph_h
+
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+
+#include "juwhan_std.h"
+#include "thread_task.h"
+#include "argument_storage.h"
+#include "task_group.h"
+
+// This header file defines task graphs whose shape is fixed at compile time.
+//
+// Nodes are numbered by their position in the list of callables. Edges are template arguments, and each must go from a lower index to a higher one, so the graph is acyclic by construction.
+// Predecessor counts are compile time constants and successor lists are index sequences. All nodes live in the graph object itself.
+// Running the graph allocates nothing and builds nothing. It works on either pool.
+//
+// Usage.
+//
+//     auto g = make_static_task_graph<edges<edge<0, 1>, edge<0, 2>, edge<1, 3>, edge<2, 3>>>(
+//             threadpool::instance,
+//             [&] { load(); },
+//             [&] { parse_header(); },
+//             [&] { parse_body(); },
+//             [&] { store(); });
+//     for (...) g.run();
+
+#define stg_info(...)
+#define stg_info_if(...)
+
+namespace juwhan {
+
+
+// An edge from node From to node To.
+    template<size_t From, size_t To>
+    struct edge {
+        static_assert(From < To, "An edge of a static task graph must go from a lower node index to a higher one.");
+        static constexpr size_t from = From;
+        static constexpr size_t to = To;
+    };
+
+// The list of edges of a graph.
+    template<typename... E>
+    struct edges {
+    };
+
+
+// The number of edges into node J.
+    template<size_t J, typename... E>
+    struct static_predecessor_count : integral_constant<size_t, 0> {
+    };
+
+    template<size_t J, typename E, typename... R>
+    struct static_predecessor_count<J, E, R...>
+            : integral_constant<size_t, (E::to == J ? 1 : 0) + static_predecessor_count<J, R...>::value> {
+    };
+
+
+// The successors of node J, as an index_sequence.
+    template<size_t J, typename S, typename... E>
+    struct static_successors_helper {
+        using type = S;
+    };
+
+    template<size_t J, size_t... K, typename E, typename... R>
+    struct static_successors_helper<J, index_sequence<K...>, E, R...>
+            : static_successors_helper<J,
+                    typename conditional<E::from == J, index_sequence<K..., E::to>, index_sequence<K...>>::type,
+                    R...> {
+    };
+
+    template<size_t J, typename... E>
+    using static_successors = typename static_successors_helper<J, index_sequence<>, E...>::type;
+
+
+// A node. It calls back into the graph on completion; G is complete by the time operator() is instantiated.
+    template<typename G, size_t I, typename F>
+    struct static_task_graph_node : public thread_task {
+        F func;
+        G *graph;
+
+        template<typename FF>
+        static_task_graph_node(G &graph_, FF &&func_) : func(::juwhan::forward<FF>(func_)), graph{&graph_} {};
+
+        static_task_graph_node(static_task_graph_node &&other)
+                : func(::juwhan::move(other.func)), graph{other.graph} {};
+
+        void operator()() {
+            try { func(); }
+            catch (::std::exception &e) { graph->state.set_exception(e); }
+            catch (...) {
+                ::std::runtime_error e{"A static_task_graph node threw an exception that is not a ::std::exception."};
+                graph->state.set_exception(e);
+            }
+            graph->template complete<I>();
+        };
+
+        bool is_pool_owned() const { return false; };
+    };
+
+
+    template<typename TP, typename G, typename S, typename... F>
+    struct static_task_graph_implementation {
+    };
+
+    template<typename TP, typename... E, size_t... I, typename... F>
+    struct static_task_graph_implementation<TP, edges<E...>, index_sequence<I...>, F...> {
+        using self_type = static_task_graph_implementation;
+        static constexpr size_t node_count = sizeof...(F);
+        static_assert(node_count > 0, "A static task graph needs at least one node.");
+
+        TP &tp;
+        task_group_state state;
+        ::std::atomic<size_t> pending[node_count];
+        argument_storage<static_task_graph_node<self_type, I, F>...> nodes;
+
+        template<typename... FF>
+        explicit static_task_graph_implementation(TP &tp_, FF &&... funcs)
+                : tp(tp_), state{}, nodes{static_task_graph_node<self_type, I, F>{*this, ::juwhan::forward<FF>(funcs)}...} {};
+
+        // Moving is for returning from make_static_task_graph. Never move a running graph.
+        static_task_graph_implementation(static_task_graph_implementation &&other)
+                : tp(other.tp), state{},
+                  nodes{static_task_graph_node<self_type, I, F>{*this, ::juwhan::move(other.nodes.template get<I>().func)}...} {};
+
+        static_task_graph_implementation(static_task_graph_implementation &other) = delete;
+
+        static_task_graph_implementation &operator=(static_task_graph_implementation &other) = delete;
+
+        ~static_task_graph_implementation() {
+            if (!state.is_done()) {
+                auto s = &state;
+                tp.help_until([s] { return s->is_done(); });
+            }
+        };
+
+        // Release one successor. It goes to this thread's queue once all its predecessors are done.
+        template<size_t K>
+        void release() {
+            if (pending[K].fetch_sub(1, ::std::memory_order_acq_rel) == 1) {
+                stg_info("A node became ready. I will push it into my queue.");
+                tp.enqueue(&nodes.template get<K>());
+            }
+        };
+
+        template<size_t... K>
+        void release_all(index_sequence<K...>) {
+            int expand[] = {0, (release<K>(), 0)...};
+            (void) expand;
+        };
+
+        // Called by node J when it is done.
+        template<size_t J>
+        void complete() {
+            release_all(static_successors<J, E...>{});
+            // This must be the last touch of the graph. The runner may return right after.
+            state.pending.fetch_sub(1, ::std::memory_order_acq_rel);
+        };
+
+        size_t size() { return node_count; };
+
+        // Run the whole graph and return when every node is done.
+        // Exceptions thrown by nodes do not stop the graph. The first one is rethrown here as a runtime_error.
+        void run() {
+            int reset[] = {0, (pending[I].store(static_predecessor_count<I, E...>::value, ::std::memory_order_relaxed), 0)...};
+            (void) reset;
+            state.pending.store(node_count, ::std::memory_order_release);
+            stg_info("I will release the roots of a static task graph.");
+            int roots[] = {0, (static_predecessor_count<I, E...>::value == 0 ? (tp.enqueue(&nodes.template get<I>()), 0) : 0)...};
+            (void) roots;
+            auto s = &state;
+            tp.help_until([s] { return s->is_done(); });
+            if (state.is_exceptional()) {
+                state._is_exceptional.store(false, ::std::memory_order_relaxed);
+                throw ::std::runtime_error(state.exception_message);
+            }
+        };
+    };
+
+
+    template<typename TP, typename G, typename... F>
+    using static_task_graph = static_task_graph_implementation<TP, G, index_sequence_for<F...>, F...>;
+
+
+// The graph type make_static_task_graph returns for callables of types F.
+    template<typename TP, typename G, typename... F>
+    struct static_task_graph_for {
+        using type = static_task_graph_implementation<TP, G, index_sequence_for<F...>, typename decay<F>::type...>;
+    };
+
+
+// Make a static task graph. G is an edges<...> list and funcs are the nodes, in index order.
+    template<typename G, typename TP, typename... F>
+    inline typename static_task_graph_for<TP, G, F...>::type make_static_task_graph(TP &tp, F &&... funcs) {
+        return typename static_task_graph_for<TP, G, F...>::type{tp, ::juwhan::forward<F>(funcs)...};
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
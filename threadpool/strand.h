@@ -0,0 +1,187 @@
+#ifndef juwhan_strand_h
+#define juwhan_strand_h
+
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+
+#include "juwhan_std.h"
+#include "thread_task.h"
+
+#include "include_me.h"
+
+// This header file defines a strand, which runs the tasks posted to it one at a time, in the order they were posted, on whichever worker of a pool is free.
+//
+// State that must be touched by one task at a time(e.g. a connection) gets a strand instead of a mutex. Nobody blocks: a post only queues the task.
+// Posted tasks go into an intrusive lock-free queue with many producers and one consumer, after Dmitry Vyukov's MPSC queue. One exchange per post, and no lock.
+// A scheduled flag makes sure at most one drain task is in the pool at a time. The post that raises it enqueues the drain task, which lives in the strand and is never allocated.
+// The drain task runs up to JUWHAN_STRAND_BATCH tasks, and then goes back to the pool, so that a busy strand does not hold a worker for good.
+//
+// Exceptions thrown by strand tasks go to the exception handler of the pool, as for post.
+// The destructor helps the pool until the strand is idle. Do not post to a strand that is being destroyed.
+//
+// Usage.
+//
+//     strand<threadpool> s{threadpool::instance};
+//     s.post([&] { connection.write(a); });
+//     s.post([&] { connection.write(b); });   // Runs after the one above, maybe on another worker.
+
+#define st_info(...)
+#define st_info_if(...)
+
+// The number of tasks a drain task runs before it goes back to the pool.
+#ifndef JUWHAN_STRAND_BATCH
+#define JUWHAN_STRAND_BATCH 64
+#endif
+
+namespace juwhan {
+
+
+// A link in the queue of a strand.
+    struct strand_link {
+        ::std::atomic<strand_link *> next;
+
+        strand_link() : next{nullptr} {};
+
+        virtual void run() {};
+
+        virtual ~strand_link() {};
+    };
+
+
+// A posted task with its link.
+    template<typename T>
+    struct strand_item : public strand_link {
+        T task;
+
+        template<typename... A>
+        strand_item(A &&... args) : strand_link{}, task(::juwhan::forward<A>(args)...) {};
+
+        void run() { task(); };
+    };
+
+
+    template<typename TP>
+    struct strand;
+
+
+// The drain task of a strand. It lives in the strand, and the pool does not delete it.
+    template<typename TP>
+    struct strand_drain_task : public thread_task {
+        strand<TP> *owner;
+
+        void operator()() { owner->drain(); };
+
+        bool is_pool_owned() const { return false; };
+    };
+
+
+    template<typename TP>
+    struct strand {
+        TP &tp;
+        // Producers push at the head. The drain task pops at the tail.
+        ::std::atomic<strand_link *> head;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+        strand_link *tail;
+        strand_link stub;
+        strand_drain_task<TP> drain_task;
+        char pad1[JUWHAN_CACHELINE_SIZE];
+        ::std::atomic<bool> scheduled;
+        // Drain tasks enqueued and not yet returned. The strand may go only when it is zero.
+        ::std::atomic<size_t> in_flight;
+        char pad2[JUWHAN_CACHELINE_SIZE];
+
+        strand(TP &tp_) : tp(tp_), head{&stub}, tail{&stub}, stub{}, drain_task{}, scheduled{false}, in_flight{0} {
+            drain_task.owner = this;
+        };
+
+        ~strand() { wait(); };
+
+        strand(strand &other) = delete;
+
+        strand &operator=(strand &other) = delete;
+
+        void push(strand_link *link) {
+            link->next.store(nullptr, ::std::memory_order_relaxed);
+            auto previous = head.exchange(link, ::std::memory_order_acq_rel);
+            previous->next.store(link, ::std::memory_order_release);
+        };
+
+        // Take the oldest link, or nullptr. nullptr while not empty means a push is half way through.
+        strand_link *pop() {
+            auto oldest = tail;
+            auto next = oldest->next.load(::std::memory_order_acquire);
+            if (oldest == &stub) {
+                if (!next) return nullptr;
+                tail = oldest = next;
+                next = next->next.load(::std::memory_order_acquire);
+            }
+            if (next) {
+                tail = next;
+                return oldest;
+            }
+            if (oldest != head.load(::std::memory_order_acquire)) return nullptr;
+            // The oldest is the only one left. Put the stub behind it, so that it can be taken.
+            push(&stub);
+            next = oldest->next.load(::std::memory_order_acquire);
+            if (next) {
+                tail = next;
+                return oldest;
+            }
+            return nullptr;
+        };
+
+        // Only the drain task may call it.
+        bool is_empty() {
+            return !tail->next.load(::std::memory_order_acquire) && head.load(::std::memory_order_seq_cst) == tail;
+        };
+
+        void schedule() {
+            in_flight.fetch_add(1, ::std::memory_order_relaxed);
+            tp.enqueue(&drain_task);
+        };
+
+        void drain() {
+            for (auto i = 0; i < JUWHAN_STRAND_BATCH; ++i) {
+                auto link = pop();
+                if (!link) {
+                    // A post is half way through. It is a matter of a few instructions.
+                    if (!is_empty()) continue;
+                    // Give up the flag, and take it back if a post came in between.
+                    scheduled.store(false, ::std::memory_order_seq_cst);
+                    if (is_empty() || scheduled.exchange(true, ::std::memory_order_seq_cst)) {
+                        in_flight.fetch_sub(1, ::std::memory_order_release);
+                        return;
+                    }
+                    continue;
+                }
+                try { link->run(); }
+                catch (::std::exception &e) { if (tp.exception_handler) tp.exception_handler(e); }
+                catch (...) {
+                    ::std::runtime_error e{"A strand task threw an exception that is not a ::std::exception."};
+                    if (tp.exception_handler) tp.exception_handler(e);
+                }
+                delete link;
+            }
+            st_info("The strand ran a full batch. It goes back to the pool.");
+            schedule();
+            in_flight.fetch_sub(1, ::std::memory_order_release);
+        };
+
+        // Queue a task. It runs after all tasks posted before it have run.
+        template<typename F, typename... A>
+        void post(F &&func_, A &&... args) {
+            push(new strand_item<detached_task_type_for<F, A...>>{::juwhan::forward<F>(func_), ::juwhan::forward<A>(args)...});
+            if (!scheduled.exchange(true, ::std::memory_order_seq_cst)) schedule();
+        };
+
+        // Help the pool until all tasks posted so far have run.
+        void wait() {
+            tp.help_until([this] { return in_flight.load(::std::memory_order_acquire) == 0; });
+        };
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef juwhan_task_graph_h
+#define juwhan_task_graph_h
+
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <vector>
+
+#include "juwhan_std.h"
+#include "thread_task.h"
+#include "task_group.h"
+
+// This header file defines a task dependency graph(DAG) executor on top of a pool.
+//
+// Nodes are callables and edges are dependencies. Each node keeps an atomic count of the predecessors it still waits for.
+// When a node completes, it decrements the counts of its successors, and the ones that reach zero are pushed to the completing thread's own queue. Nobody blocks inside a task, and independent branches overlap as much as the pool allows.
+//
+// Usage.
+//
+//     task_graph<threadpool> g{threadpool::instance};
+//     auto load = g.emplace([&] { ... });
+//     auto parse = g.emplace([&] { ... });
+//     auto index = g.emplace([&] { ... });
+//     auto store = g.emplace([&] { ... });
+//     load->precede(parse);
+//     parse->precede(index);
+//     parse->precede(store);
+//     g.run();    // May be run again and again.
+
+#define tgr_info(...)
+#define tgr_info_if(...)
+
+namespace juwhan {
+
+
+    template<typename TP>
+    struct task_graph {
+        // A node. The graph owns it; the pool never deletes it.
+        struct node : public thread_task {
+            task_graph *graph;
+            size_t index;
+            ::std::atomic<size_t> pending;
+            size_t predecessor_count;
+            ::std::vector<node *> successors;
+
+            explicit node(task_graph &graph_)
+                    : graph{&graph_}, index{graph_.nodes.size()}, pending{0}, predecessor_count{0}, successors{} {};
+
+            node(node &other) = delete;
+
+            node &operator=(node &other) = delete;
+
+            virtual void body() = 0;
+
+            // Make this node run before the other.
+            void precede(node *other) {
+                successors.push_back(other);
+                ++other->predecessor_count;
+                graph->is_validated = false;
+            };
+
+            // Make this node run after the other.
+            void succeed(node *other) { other->precede(this); };
+
+            void operator()() {
+                try { body(); }
+                catch (::std::exception &e) { graph->state.set_exception(e); }
+                catch (...) {
+                    ::std::runtime_error e{"A task_graph node threw an exception that is not a ::std::exception."};
+                    graph->state.set_exception(e);
+                }
+                // Release successors. The ready ones go to this thread's queue, where they are likely to find their inputs in cache.
+                for (size_t i = 0; i < successors.size(); ++i) {
+                    auto successor = successors[i];
+                    if (successor->pending.fetch_sub(1, ::std::memory_order_acq_rel) == 1) {
+                        tgr_info("A node became ready. I will push it into my queue.");
+                        graph->tp.enqueue(successor);
+                    }
+                }
+                // This must be the last touch of the graph. The runner may return right after.
+                graph->state.pending.fetch_sub(1, ::std::memory_order_acq_rel);
+            };
+
+            bool is_pool_owned() const { return false; };
+        };
+
+        template<typename F>
+        struct node_implementation : public node {
+            F func;
+
+            template<typename FF>
+            node_implementation(task_graph &graph_, FF &&func_) : node{graph_}, func(::juwhan::forward<FF>(func_)) {};
+
+            void body() { func(); };
+        };
+
+        TP &tp;
+        task_group_state state;
+        ::std::vector<node *> nodes;
+        ::std::vector<node *> roots;
+        bool is_validated;
+
+        explicit task_graph(TP &tp_) : tp(tp_), state{}, nodes{}, roots{}, is_validated{false} {};
+
+        // A task_graph may not be copied, moved, or assigned to another.
+        task_graph(task_graph &other) = delete;
+
+        task_graph(task_graph &&other) = delete;
+
+        task_graph &operator=(task_graph &other) = delete;
+
+        task_graph &operator=(task_graph &&other) = delete;
+
+        ~task_graph() {
+            // Never delete nodes that are still running.
+            if (!state.is_done()) {
+                auto s = &state;
+                tp.help_until([s] { return s->is_done(); });
+            }
+            for (size_t i = 0; i < nodes.size(); ++i) delete nodes[i];
+        };
+
+        // Add a node.
+        template<typename F>
+        node *emplace(F &&func_) {
+            auto new_node = new node_implementation<typename decay<F>::type>{*this, ::juwhan::forward<F>(func_)};
+            nodes.push_back(new_node);
+            is_validated = false;
+            return new_node;
+        };
+
+        // Make a run before b.
+        void precede(node *a, node *b) { a->precede(b); };
+
+        size_t size() { return nodes.size(); };
+
+        // Collect roots and make sure there is no cycle(Kahn's algorithm). Done once per change of the graph.
+        void validate() {
+            tgr_info("I will validate a task graph.");
+            roots.clear();
+            ::std::vector<size_t> in_degree(nodes.size());
+            ::std::vector<node *> ready;
+            for (size_t i = 0; i < nodes.size(); ++i) {
+                in_degree[i] = nodes[i]->predecessor_count;
+                if (in_degree[i] == 0) {
+                    roots.push_back(nodes[i]);
+                    ready.push_back(nodes[i]);
+                }
+            }
+            size_t visited{0};
+            while (!ready.empty()) {
+                auto n = ready.back();
+                ready.pop_back();
+                ++visited;
+                for (size_t i = 0; i < n->successors.size(); ++i) {
+                    auto s = n->successors[i];
+                    if (--in_degree[s->index] == 0) ready.push_back(s);
+                }
+            }
+            if (visited != nodes.size())
+                throw ::std::runtime_error("A task graph has a cycle. It cannot be run.");
+            is_validated = true;
+        };
+
+        // Run the whole graph and return when every node is done.
+        // Exceptions thrown by nodes do not stop the graph. The first one is rethrown here as a runtime_error.
+        void run() {
+            if (!is_validated) validate();
+            if (nodes.empty()) return;
+            for (size_t i = 0; i < nodes.size(); ++i)
+                nodes[i]->pending.store(nodes[i]->predecessor_count, ::std::memory_order_relaxed);
+            state.pending.store(nodes.size(), ::std::memory_order_release);
+            tgr_info("I will release the roots of a task graph.");
+            for (size_t i = 0; i < roots.size(); ++i) tp.enqueue(roots[i]);
+            auto s = &state;
+            tp.help_until([s] { return s->is_done(); });
+            if (state.is_exceptional()) {
+                state._is_exceptional.store(false, ::std::memory_order_relaxed);
+                throw ::std::runtime_error(state.exception_message);
+            }
+        };
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef juwhan_task_group_h
+#define juwhan_task_group_h
+
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <string>
+
+#include "juwhan_std.h"
+#include "thread_task.h"
+#include "argument_storage.h"
+
+// This header file defines structured fork-join on top of a pool.
+//
+// A task_group spawns child tasks whose records live in the parent's stack frame. Completion is tracked by a single atomic counter in the group, and the group joins on exit by helping the pool.
+// Nothing is allocated on the heap: no task, no function_return_type, no receipt.
+//
+// Usage.
+//
+//     task_group<threadpool> g{threadpool::instance};
+//     auto left = g.make_child([&] { sort(begin, middle); });
+//     auto right = g.make_child([&] { sort(middle, end); });
+//     g.run(left);
+//     g.run(right);
+//     g.wait();   // Or let the destructor do it.
+//
+// parallel_invoke(pool, f0, f1, ...) does the same for a fixed set of callables in one line.
+
+#define tg_info(...)
+#define tg_info_if(...)
+
+namespace juwhan {
+
+
+// The part of a task group its children see. It does not depend on the pool type.
+    struct task_group_state {
+        ::std::atomic<size_t> pending;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+        ::std::atomic<bool> _is_exceptional;
+        ::std::string exception_message;
+
+        task_group_state() : pending{0}, _is_exceptional{false}, exception_message{} {};
+
+        task_group_state(task_group_state &other) = delete;
+
+        task_group_state &operator=(task_group_state &other) = delete;
+
+        bool is_done() { return pending.load(::std::memory_order_acquire) == 0; };
+
+        // The first exception wins. The others are dropped.
+        void set_exception(::std::exception &e) {
+            bool expected{false};
+            if (_is_exceptional.compare_exchange_strong(expected, true, ::std::memory_order_relaxed))
+                exception_message = e.what();
+        };
+
+        bool is_exceptional() { return _is_exceptional.load(::std::memory_order_relaxed); };
+    };
+
+
+// A child task. It lives wherever its owner puts it, usually the stack frame of the spawning function.
+// The destructor waits for the child to finish, so a child going out of scope before its group is still safe.
+    template<typename TP, typename F>
+    struct task_group_child : public thread_task {
+        F func;
+        TP *tp;
+        task_group_state *group;
+        ::std::atomic<bool> finished;
+
+        template<typename FF>
+        task_group_child(TP &tp_, task_group_state &group_, FF &&func_)
+                : func(::juwhan::forward<FF>(func_)), tp{&tp_}, group{&group_}, finished{true} {};
+
+        task_group_child(task_group_child &&other)
+                : func(::juwhan::move(other.func)), tp{other.tp}, group{other.group}, finished{true} {};
+
+        task_group_child(task_group_child &other) = delete;
+
+        task_group_child &operator=(task_group_child &other) = delete;
+
+        void operator()() {
+            try { func(); }
+            catch (::std::exception &e) { group->set_exception(e); }
+            catch (...) {
+                ::std::runtime_error e{"A task_group child threw an exception that is not a ::std::exception."};
+                group->set_exception(e);
+            }
+            // Neither the group nor this child may be touched after these two stores. The owner may return right away.
+            group->pending.fetch_sub(1, ::std::memory_order_acq_rel);
+            finished.store(true, ::std::memory_order_release);
+        };
+
+        bool is_pool_owned() const { return false; };
+
+        ~task_group_child() {
+            if (!finished.load(::std::memory_order_acquire)) {
+                auto self = this;
+                tp->help_until([self] { return self->finished.load(::std::memory_order_acquire); });
+            }
+        };
+    };
+
+
+    template<typename TP>
+    struct task_group : task_group_state {
+        TP &tp;
+
+        explicit task_group(TP &tp_) : task_group_state{}, tp(tp_) {};
+
+        // Make a child record. Keep it in the caller's frame and hand it to run().
+        template<typename F>
+        task_group_child<TP, typename decay<F>::type> make_child(F &&func_) {
+            return task_group_child<TP, typename decay<F>::type>{tp, *this, ::juwhan::forward<F>(func_)};
+        };
+
+        // Spawn a child into my queue.
+        template<typename F>
+        void run(task_group_child<TP, F> &child) {
+            tg_info("I will spawn a child of a task group.");
+            child.finished.store(false, ::std::memory_order_relaxed);
+            pending.fetch_add(1, ::std::memory_order_relaxed);
+            tp.enqueue(&child);
+        };
+
+        // Spawn a child into the mailbox of the worker at index, instead of my queue.
+        template<typename F>
+        void mail(task_group_child<TP, F> &child, size_t index) {
+            tg_info("I will mail a child of a task group to " + to_string(index) + ".");
+            child.finished.store(false, ::std::memory_order_relaxed);
+            pending.fetch_add(1, ::std::memory_order_relaxed);
+            tp.mail(&child, index);
+        };
+
+        // Run a child in this thread, without spawning. It still counts as a member of the group.
+        template<typename F>
+        void run_inline(task_group_child<TP, F> &child) {
+            child.finished.store(false, ::std::memory_order_relaxed);
+            pending.fetch_add(1, ::std::memory_order_relaxed);
+            child();
+        };
+
+        // Join. Help the pool until all children are done.
+        void wait() {
+            if (!is_done()) {
+                tg_info("I am joining a task group. I will help while waiting.");
+                auto self = this;
+                tp.help_until([self] { return self->is_done(); });
+            }
+            if (is_exceptional()) {
+                _is_exceptional.store(false, ::std::memory_order_relaxed);
+                throw ::std::runtime_error(exception_message);
+            }
+        };
+
+        ~task_group() {
+            // Do not throw from the destructor. Call wait() to see exceptions.
+            if (!is_done()) {
+                auto self = this;
+                tp.help_until([self] { return self->is_done(); });
+            }
+        };
+    };
+
+
+// parallel_invoke helpers.
+    template<typename TP, typename... F>
+    struct parallel_invoke_helper {
+    };
+
+    template<typename TP, size_t... I, typename... F>
+    struct parallel_invoke_helper<TP, index_sequence<I...>, F...> {
+        // Spawn every child but the first, which is run by this thread.
+        template<typename G, typename C>
+        static void spawn_rest(G &group, C &children) {
+            int expand[] = {0, (I > 0 ? (group.run(children.template get<I>()), 0) : 0)...};
+            (void) expand;
+        };
+    };
+
+
+// Run all callables in parallel and return when all are done.
+// Child records live in this function's frame. The first callable runs in the calling thread.
+    template<typename TP, typename... F>
+    inline void parallel_invoke(TP &tp, F &&... funcs) {
+        task_group<TP> group{tp};
+        argument_storage<task_group_child<TP, typename decay<F>::type>...> children{
+                task_group_child<TP, typename decay<F>::type>{tp, group, ::juwhan::forward<F>(funcs)}...};
+        parallel_invoke_helper<TP, index_sequence_for<F...>, F...>::spawn_rest(group, children);
+        group.run_inline(children.template get<0>());
+        group.wait();
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
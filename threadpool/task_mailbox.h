@@ -0,0 +1,68 @@
+#ifndef juwhan_task_mailbox_h
+#define juwhan_task_mailbox_h
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+#include "juwhan_std.h"
+#include "thread_task.h"
+
+#include "include_me.h"
+
+// This header file defines a mailbox, through which a task is sent to a particular worker of a pool.
+//
+// Unlike a work stealing queue, anyone may put a task into a mailbox. The owner takes its mail before looking at its own queue, and the others take it only when there is nothing left to steal.
+// Mail is rare compared to spawns, so a lock is fine. An empty mailbox is told apart by a counter, without touching the lock.
+
+#define mb_info(...)
+#define mb_info_if(...)
+
+namespace juwhan {
+
+
+    struct task_mailbox {
+        ::std::atomic<size_t> count;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+        ::std::mutex mut;
+        ::std::deque<thread_task *> tasks;
+        // The number of tasks ever put in. Kept under the lock.
+        size_t received;
+
+        task_mailbox() : count{0}, mut{}, tasks{}, received{0} {};
+
+        task_mailbox(task_mailbox &other) = delete;
+
+        task_mailbox &operator=(task_mailbox &other) = delete;
+
+        bool empty() { return count.load(::std::memory_order_acquire) == 0; };
+
+        void push(thread_task *task) {
+            ::std::lock_guard<::std::mutex> lg{mut};
+            tasks.push_back(task);
+            ++received;
+            count.fetch_add(1, ::std::memory_order_release);
+        };
+
+        size_t received_count() {
+            ::std::lock_guard<::std::mutex> lg{mut};
+            return received;
+        };
+
+        // Take the oldest task, or nullptr.
+        thread_task *pop() {
+            if (empty()) return nullptr;
+            ::std::lock_guard<::std::mutex> lg{mut};
+            if (tasks.empty()) return nullptr;
+            auto task = tasks.front();
+            tasks.pop_front();
+            count.fetch_sub(1, ::std::memory_order_relaxed);
+            mb_info("I took a task out of a mailbox.");
+            return task;
+        };
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef juwhan_task_sync_h
+#define juwhan_task_sync_h
+
+#include <atomic>
+#include <stdexcept>
+
+#include "juwhan_std.h"
+
+#include "include_me.h"
+
+// This header file defines a mutex, a semaphore and a latch for tasks running on a pool.
+//
+// A task blocking on a ::std::mutex or a ::std::condition_variable takes its worker away from the pool. With as many workers as cores, that costs a core, or deadlocks when the task that would wake it has nowhere to run.
+// A contended wait here goes through three steps instead.
+//  1. Check again, JUWHAN_TASK_SPIN_COUNT times. Most locks are held briefly.
+//  2. Help the pool(help_until, which fetches tasks through fetch_task), as a receipt does.
+//  3. Once this thread is JUWHAN_TASK_WAIT_DEPTH waits deep, park(park_until) rather than help. A task picked up while helping may wait in turn, and each level holds a stack frame.
+// The fast paths are a single atomic operation. The pool is notified on release only when somebody is waiting.
+//
+// Do not wait on one of these while holding a task_mutex. A task picked up while helping may want the same mutex, and it would wait above the holder for good.
+//
+// Usage.
+//
+//     task_mutex<threadpool> m{threadpool::instance};
+//     {
+//         ::std::lock_guard<task_mutex<threadpool>> lg{m};
+//         ...
+//     }
+//
+//     task_latch<threadpool> done{threadpool::instance, n};
+//     for (auto i = 0; i < n; ++i) threadpool::instance.post([&] { work(); done.count_down(); });
+//     done.wait();
+
+#define ts_info(...)
+#define ts_info_if(...)
+
+// The number of times a contended wait checks again before it helps the pool.
+#ifndef JUWHAN_TASK_SPIN_COUNT
+#define JUWHAN_TASK_SPIN_COUNT 64
+#endif
+
+// How many waits may be nested on a thread by helping, before a wait parks instead.
+#ifndef JUWHAN_TASK_WAIT_DEPTH
+#define JUWHAN_TASK_WAIT_DEPTH 8
+#endif
+
+namespace juwhan {
+
+
+// How deep a thread is in waits that help. Every worker of a pool owns one, and only the worker touches it.
+    struct wait_depth {
+        size_t value;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+
+        wait_depth() : value{0} {};
+
+        wait_depth(wait_depth &other) = delete;
+
+        wait_depth &operator=(wait_depth &other) = delete;
+    };
+
+
+// The waiting side, shared by the primitives below.
+    template<typename TP>
+    struct task_sync_state {
+        TP &tp;
+        ::std::atomic<size_t> waiting;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+
+        task_sync_state(TP &tp_) : tp(tp_), waiting{0} {};
+
+        task_sync_state(task_sync_state &other) = delete;
+
+        task_sync_state &operator=(task_sync_state &other) = delete;
+
+        // A waiter that may sleep counts itself in before it checks, and this checks the count after the change.
+        void wake() {
+            ::std::atomic_thread_fence(::std::memory_order_seq_cst);
+            if (waiting.load(::std::memory_order_relaxed) > 0) tp.notify();
+        };
+
+        // The condition may take what it waits for(e.g. try_lock), so it is not checked again once met.
+        template<typename P>
+        void wait_until(P condition) {
+            for (auto i = 0; i < JUWHAN_TASK_SPIN_COUNT; ++i) if (condition()) return;
+            bool is_met{false};
+            auto check = [&is_met, &condition] { return is_met || (is_met = condition()); };
+            waiting.fetch_add(1, ::std::memory_order_seq_cst);
+            auto &depth = tp.my_wait_depth();
+            if (depth < JUWHAN_TASK_WAIT_DEPTH) {
+                ts_info("I will help the pool while waiting.");
+                ++depth;
+                tp.help_until(check);
+                --depth;
+            } else {
+                ts_info("I am too deep in waits. I will park.");
+                tp.park_until(check);
+            }
+            waiting.fetch_sub(1, ::std::memory_order_relaxed);
+            if (!is_met) throw ::std::runtime_error("The pool was destroyed while a task was waiting.");
+        };
+    };
+
+
+// A mutex. It works with ::std::lock_guard and ::std::unique_lock.
+    template<typename TP>
+    struct task_mutex {
+        task_sync_state<TP> state;
+        ::std::atomic<bool> locked;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+
+        task_mutex(TP &tp_) : state{tp_}, locked{false} {};
+
+        bool try_lock() {
+            return !locked.load(::std::memory_order_relaxed) && !locked.exchange(true, ::std::memory_order_acquire);
+        };
+
+        void lock() {
+            if (try_lock()) return;
+            state.wait_until([this] { return try_lock(); });
+        };
+
+        void unlock() {
+            locked.store(false, ::std::memory_order_release);
+            state.wake();
+        };
+    };
+
+
+// A counting semaphore.
+    template<typename TP>
+    struct task_semaphore {
+        task_sync_state<TP> state;
+        ::std::atomic<size_t> count;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+
+        task_semaphore(TP &tp_, size_t count_) : state{tp_}, count{count_} {};
+
+        bool try_acquire() {
+            auto current = count.load(::std::memory_order_relaxed);
+            while (current > 0) {
+                if (count.compare_exchange_weak(current, current - 1, ::std::memory_order_acquire, ::std::memory_order_relaxed)) return true;
+            }
+            return false;
+        };
+
+        void acquire() {
+            if (try_acquire()) return;
+            state.wait_until([this] { return try_acquire(); });
+        };
+
+        void release(size_t n = 1) {
+            count.fetch_add(n, ::std::memory_order_release);
+            state.wake();
+        };
+    };
+
+
+// A single use latch. wait() returns once count_down has brought the count to zero.
+// The latch may go as soon as wait() returns. The count_down that brings it to zero touches only the pool after that.
+    template<typename TP>
+    struct task_latch {
+        task_sync_state<TP> state;
+        ::std::atomic<size_t> count;
+        char pad0[JUWHAN_CACHELINE_SIZE];
+
+        task_latch(TP &tp_, size_t count_) : state{tp_}, count{count_} {};
+
+        void count_down(size_t n = 1) {
+            auto &tp = state.tp;
+            // Once a single time, so the pool is notified without looking for waiters.
+            if (count.fetch_sub(n, ::std::memory_order_acq_rel) == n) tp.notify();
+        };
+
+        bool try_wait() { return count.load(::std::memory_order_acquire) == 0; };
+
+        void wait() {
+            if (try_wait()) return;
+            state.wait_until([this] { return try_wait(); });
+        };
+
+        void arrive_and_wait(size_t n = 1) {
+            count_down(n);
+            wait();
+        };
+    };
+
+
+} // End of namespace juwhan.
+
+#endif
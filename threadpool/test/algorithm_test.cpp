@@ -0,0 +1,533 @@
+#include <iostream>
+#include <stdexcept>
+#include <chrono>
+#include <time.h>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <numeric>
+
+#include "threadpool.h"
+#include "greedy_threadpool.h"
+#include "parallel_for.h"
+#include "parallel_reduce.h"
+#include "combinable.h"
+#include "parallel_scan.h"
+#include "parallel_select.h"
+#include "parallel_for_tiled.h"
+#include "splittable_task.h"
+#include "divide_and_conquer.h"
+#include "parallel_do.h"
+#include "parallel_pipeline.h"
+#include "channel.h"
+#include "strand.h"
+#include "task_sync.h"
+#include "parallel_algorithm.h"
+
+using namespace juwhan;
+using namespace std;
+using namespace std::chrono;
+
+static uint64_t N = 1000000;
+static unsigned int M = 10;
+
+
+inline unsigned int work(unsigned int x) {
+    for (auto i = 0; i < 16; ++i) x = x * 1664525u + 1013904223u;
+    return x;
+}
+
+
+template<typename TP, typename P>
+void test_parallel_for(const char *name, const vector<unsigned int> &in, const vector<unsigned int> &expected, P partitioner) {
+    vector<unsigned int> out(N);
+    steady_clock::time_point tim = steady_clock::now();
+    for (unsigned int i = 0; i < M; ++i) {
+        parallel_for(TP::instance, blocked_range<size_t>{0, N, 1024}, [&](const blocked_range<size_t> &r) {
+            for (auto j = r.begin(); j != r.end(); ++j) out[j] = work(in[j]);
+        }, partitioner);
+    }
+    auto dur = steady_clock::now() - tim;
+    cout << name << " " << duration_cast<milliseconds>(dur).count() << " ";
+    // Verify.
+    for (unsigned int i = 0; i < N; ++i) if (out[i] != expected[i]) throw "Something's wrong";
+}
+
+
+template<typename TP>
+void test_lazy_parallel_for(const vector<unsigned int> &in, const vector<unsigned int> &expected) {
+    vector<unsigned int> out(N);
+    steady_clock::time_point tim = steady_clock::now();
+    for (unsigned int i = 0; i < M; ++i) {
+        lazy_parallel_for(TP::instance, blocked_range<size_t>{0, N, 1024}, [&](const blocked_range<size_t> &r) {
+            for (auto j = r.begin(); j != r.end(); ++j) out[j] = work(in[j]);
+        });
+    }
+    auto dur = steady_clock::now() - tim;
+    cout << "lazy " << duration_cast<milliseconds>(dur).count() << " ";
+    for (unsigned int i = 0; i < N; ++i) if (out[i] != expected[i]) throw "Something's wrong";
+}
+
+
+template<typename TP>
+void test_parallel_reduce(const vector<unsigned int> &in, uint64_t expected) {
+    uint64_t sum{0};
+    steady_clock::time_point tim = steady_clock::now();
+    for (unsigned int i = 0; i < M; ++i) {
+        sum = parallel_reduce(TP::instance, blocked_range<size_t>{0, N, 1024}, uint64_t{0},
+                              [&](const blocked_range<size_t> &r, uint64_t partial) {
+                                  for (auto j = r.begin(); j != r.end(); ++j) partial += work(in[j]);
+                                  return partial;
+                              },
+                              [](uint64_t a, uint64_t b) { return a + b; });
+    }
+    auto dur = steady_clock::now() - tim;
+    cout << "reduce " << duration_cast<milliseconds>(dur).count() << " ";
+    if (sum != expected) throw "Something's wrong";
+    // The same through per-worker accumulators.
+    combinable<TP, uint64_t> partial_sums{TP::instance, 0};
+    parallel_for(TP::instance, blocked_range<size_t>{0, N, 1024}, [&](const blocked_range<size_t> &r) {
+        auto &local = partial_sums.local();
+        for (auto j = r.begin(); j != r.end(); ++j) local += work(in[j]);
+    });
+    if (partial_sums.combine([](uint64_t a, uint64_t b) { return a + b; }) != expected) throw "Something's wrong";
+}
+
+
+template<typename TP>
+void test_divide_and_conquer(const vector<unsigned int> &in, const vector<unsigned int> &expected, uint64_t expected_sum) {
+    using range = pair<size_t, size_t>;
+    auto halve = [](range &r) { return make_pair(range{r.first, (r.first + r.second) / 2}, range{(r.first + r.second) / 2, r.second}); };
+    steady_clock::time_point tim = steady_clock::now();
+    uint64_t sum{0};
+    for (unsigned int i = 0; i < M; ++i) {
+        sum = divide_and_conquer(TP::instance, range{0, N},
+                                 [](const range &r) { return r.second - r.first <= 1024; },
+                                 [&](range &r) {
+                                     uint64_t partial{0};
+                                     for (auto j = r.first; j != r.second; ++j) partial += work(in[j]);
+                                     return partial;
+                                 },
+                                 halve,
+                                 [](range &, uint64_t a, uint64_t b) { return a + b; });
+    }
+    auto dur = steady_clock::now() - tim;
+    cout << "dc " << duration_cast<milliseconds>(dur).count() << " ";
+    if (sum != expected_sum) throw "Something's wrong";
+    // A merge sort, with nothing to return.
+    vector<unsigned int> sorted(expected), buffer(N);
+    reverse(sorted.begin(), sorted.end());
+    divide_and_conquer(TP::instance, range{0, N},
+                       [](const range &r) { return r.second - r.first <= 1024; },
+                       [&](range &r) { sort(sorted.begin() + r.first, sorted.begin() + r.second); },
+                       halve,
+                       [&](range &r) {
+                           auto middle = (r.first + r.second) / 2;
+                           merge(sorted.begin() + r.first, sorted.begin() + middle, sorted.begin() + middle,
+                                 sorted.begin() + r.second, buffer.begin() + r.first);
+                           copy(buffer.begin() + r.first, buffer.begin() + r.second, sorted.begin() + r.first);
+                       });
+    if (!is_sorted(sorted.begin(), sorted.end())) throw "Something's wrong";
+}
+
+
+template<typename TP>
+void test_parallel_do(const vector<unsigned int> &in, uint64_t expected_sum) {
+    // Walk the implicit binary tree over [0, N), in which the children of i are 2i + 1 and 2i + 2, from its root.
+    combinable<TP, uint64_t> partial_sums{TP::instance, 0};
+    vector<size_t> root{0};
+    steady_clock::time_point tim = steady_clock::now();
+    parallel_do(TP::instance, root.begin(), root.end(), [&](size_t i, parallel_do_feeder<TP, size_t> &feeder) {
+        partial_sums.local() += work(in[i]);
+        if (2 * i + 1 < N) feeder.add(2 * i + 1);
+        if (2 * i + 2 < N) feeder.add(2 * i + 2);
+    });
+    auto dur = steady_clock::now() - tim;
+    cout << "do " << duration_cast<milliseconds>(dur).count() << " ";
+    if (partial_sums.combine([](uint64_t a, uint64_t b) { return a + b; }) != expected_sum) throw "Something's wrong";
+    // A body that throws something other than a ::std::exception comes out of parallel_do as a runtime_error.
+    bool is_thrown{false};
+    try {
+        parallel_do(TP::instance, root.begin(), root.end(), [](size_t, parallel_do_feeder<TP, size_t> &) { throw 1; });
+    }
+    catch (runtime_error &) { is_thrown = true; }
+    if (!is_thrown) throw "Something's wrong";
+}
+
+
+template<typename TP>
+void test_parallel_pipeline(const vector<unsigned int> &in, const vector<unsigned int> &expected) {
+    // Read blocks of indices in order, work on them in parallel, and write them out in order.
+    using block = pair<size_t, vector<unsigned int>>;
+    size_t next{0};
+    vector<unsigned int> out;
+    bool is_in_order{true};
+    steady_clock::time_point tim = steady_clock::now();
+    parallel_pipeline(TP::instance, 4 * TP::instance.thread_count(),
+                      make_filter<void, size_t>(filter_mode::serial_in_order, [&](flow_control &fc) -> size_t {
+                          if (next >= N) fc.stop();
+                          auto first = next;
+                          next += 1024;
+                          return first;
+                      }),
+                      make_filter<size_t, block>(filter_mode::parallel, [&](size_t first) {
+                          block b{first, vector<unsigned int>{}};
+                          for (auto j = first; j < first + 1024 && j < N; ++j) b.second.push_back(work(in[j]));
+                          return b;
+                      }),
+                      make_filter<block, void>(filter_mode::serial_in_order, [&](block b) {
+                          if (b.first != out.size()) is_in_order = false;
+                          out.insert(out.end(), b.second.begin(), b.second.end());
+                      }));
+    auto dur = steady_clock::now() - tim;
+    cout << "pipeline " << duration_cast<milliseconds>(dur).count() << " ";
+    if (!is_in_order || out != expected) throw "Something's wrong";
+    // A middle filter throws, a ::std::exception or not. The rest of the stream is discarded, and the exception comes out.
+    for (int kind = 0; kind < 2; ++kind) {
+        size_t count{0}, written{0};
+        bool is_thrown{false};
+        try {
+            parallel_pipeline(TP::instance, 4 * TP::instance.thread_count(),
+                              make_filter<void, size_t>(filter_mode::serial_in_order, [&](flow_control &fc) -> size_t {
+                                  if (count >= 1000) fc.stop();
+                                  return count++;
+                              }),
+                              make_filter<size_t, size_t>(filter_mode::parallel, [kind](size_t i) -> size_t {
+                                  if (i == 37) {
+                                      if (kind == 0) throw runtime_error("filter");
+                                      throw 37;
+                                  }
+                                  return i;
+                              }),
+                              make_filter<size_t, void>(filter_mode::serial_in_order, [&](size_t) { ++written; }));
+        }
+        catch (runtime_error &e) { is_thrown = kind == 1 || string(e.what()) == "filter"; }
+        if (!is_thrown || written > 37) throw "Something's wrong";
+    }
+}
+
+
+template<typename TP>
+void test_channel(TP &tp, const vector<unsigned int> &in, uint64_t expected_sum) {
+    // A task sends in batches, and this thread receives in batches.
+    channel<TP, unsigned int> ch{tp, 1024};
+    steady_clock::time_point tim = steady_clock::now();
+    auto producer = tp.submit([&] {
+        unsigned int batch[64];
+        for (size_t j = 0; j < N; j += 64) {
+            size_t count = 0;
+            for (; count < 64 && j + count < N; ++count) batch[count] = work(in[j + count]);
+            ch.send_batch(batch, batch + count);
+        }
+        ch.close();
+    });
+    uint64_t sum{0};
+    unsigned int batch[64];
+    while (auto count = ch.receive_batch(batch, 64)) for (size_t k = 0; k < count; ++k) sum += batch[k];
+    producer.get();
+    auto dur = steady_clock::now() - tim;
+    cout << "channel " << duration_cast<milliseconds>(dur).count() << " ";
+    if (sum != expected_sum) throw "Something's wrong";
+    // In heartbeat mode the producer is left latent on this thread. The receiving end hands it to the others before stealing.
+    tp.set_heartbeat(1000000);
+    tp.submit([] {}).get();
+    channel<TP, unsigned int> beating{tp, 16};
+    auto latent_producer = tp.submit([&] {
+        for (unsigned int i = 0; i < 100; ++i) beating.send(i);
+        beating.close();
+    });
+    unsigned int next{0}, received{0};
+    while (beating.receive(received)) if (received != next++) throw "Something's wrong";
+    latent_producer.get();
+    tp.set_heartbeat(0);
+    if (next != 100) throw "Something's wrong";
+    // The non-blocking ends, on a channel of four.
+    channel<TP, unsigned int> small{tp, 4};
+    unsigned int item{0};
+    if (small.try_receive(item)) throw "Something's wrong";
+    for (unsigned int i = 0; i < 4; ++i) if (!small.try_send(i)) throw "Something's wrong";
+    if (small.try_send(4u) || small.size() != 4) throw "Something's wrong";
+    for (unsigned int i = 0; i < 2; ++i) if (!small.try_receive(item) || item != i) throw "Something's wrong";
+    // Closed with items still in it. They are received, and then the channel reports the end.
+    small.close();
+    for (unsigned int i = 2; i < 4; ++i) if (!small.receive(item) || item != i) throw "Something's wrong";
+    unsigned int rest[4];
+    if (small.receive(item) || small.receive_batch(rest, 4) != 0) throw "Something's wrong";
+    // Sending to a closed channel throws.
+    bool is_thrown{false};
+    try { small.send(5u); }
+    catch (runtime_error &) { is_thrown = true; }
+    if (!is_thrown) throw "Something's wrong";
+    is_thrown = false;
+    try { small.try_send(5u); }
+    catch (runtime_error &) { is_thrown = true; }
+    if (!is_thrown) throw "Something's wrong";
+    // A pool of one thread would leave the first blocked end waiting for good, so it is refused.
+    is_thrown = false;
+    {
+        TP lone{1};
+        try { channel<TP, unsigned int> refused{lone, 4}; }
+        catch (runtime_error &) { is_thrown = true; }
+    }
+    if (!is_thrown) throw "Something's wrong";
+}
+
+
+template<typename TP>
+void test_strand(const vector<unsigned int> &in, uint64_t expected_sum) {
+    // Blocks worked on in parallel add into a plain sum, through a strand.
+    uint64_t sum{0};
+    strand<TP> s{TP::instance};
+    steady_clock::time_point tim = steady_clock::now();
+    parallel_for(TP::instance, blocked_range<size_t>(0, N, 1024), [&](const blocked_range<size_t> &r) {
+        uint64_t partial{0};
+        for (auto j = r.begin(); j != r.end(); ++j) partial += work(in[j]);
+        s.post([&sum, partial] { sum += partial; });
+    }, simple_partitioner{});
+    s.wait();
+    auto dur = steady_clock::now() - tim;
+    cout << "strand " << duration_cast<milliseconds>(dur).count() << " ";
+    if (sum != expected_sum) throw "Something's wrong";
+}
+
+
+template<typename TP>
+void test_task_mutex(const vector<unsigned int> &in, uint64_t expected_sum) {
+    // Blocks worked on in parallel add into a plain sum, under a task_mutex.
+    uint64_t sum{0};
+    task_mutex<TP> m{TP::instance};
+    steady_clock::time_point tim = steady_clock::now();
+    parallel_for(TP::instance, blocked_range<size_t>(0, N, 1024), [&](const blocked_range<size_t> &r) {
+        uint64_t partial{0};
+        for (auto j = r.begin(); j != r.end(); ++j) partial += work(in[j]);
+        ::std::lock_guard<task_mutex<TP>> lg{m};
+        sum += partial;
+    }, simple_partitioner{});
+    auto dur = steady_clock::now() - tim;
+    cout << "mutex " << duration_cast<milliseconds>(dur).count() << " ";
+    if (sum != expected_sum) throw "Something's wrong";
+}
+
+
+template<typename TP>
+void test_parallel_scan(const vector<unsigned int> &in) {
+    vector<uint64_t> out(N);
+    steady_clock::time_point tim = steady_clock::now();
+    uint64_t total{0};
+    for (unsigned int i = 0; i < M; ++i) {
+        total = parallel_exclusive_scan(TP::instance, in.begin(), in.end(), out.begin(), uint64_t{0},
+                                        [](uint64_t a, uint64_t b) { return a + b; });
+    }
+    auto dur = steady_clock::now() - tim;
+    cout << "scan " << duration_cast<milliseconds>(dur).count() << " ";
+    // Verify.
+    uint64_t sum{0};
+    for (unsigned int i = 0; i < N; ++i) {
+        if (out[i] != sum) throw "Something's wrong";
+        sum += in[i];
+    }
+    if (total != sum) throw "Something's wrong";
+    // The inclusive scan, against std::partial_sum.
+    vector<uint64_t> wide(in.begin(), in.end()), inclusive(N), expected_inclusive(N);
+    partial_sum(wide.begin(), wide.end(), expected_inclusive.begin());
+    total = parallel_inclusive_scan(TP::instance, in.begin(), in.end(), inclusive.begin(), uint64_t{0},
+                                    [](uint64_t a, uint64_t b) { return a + b; });
+    if (inclusive != expected_inclusive || total != sum) throw "Something's wrong";
+}
+
+
+template<typename TP>
+void test_selection(const vector<unsigned int> &expected) {
+    // The median and the top 100, against a full sort.
+    vector<unsigned int> sorted(expected), a(expected), best(100);
+    sort(sorted.begin(), sorted.end());
+    steady_clock::time_point tim = steady_clock::now();
+    parallel_nth_element(TP::instance, a.begin(), a.begin() + N / 2, a.end());
+    parallel_top_k(TP::instance, expected.begin(), expected.end(), 100, best.begin());
+    auto dur = steady_clock::now() - tim;
+    cout << "select " << duration_cast<milliseconds>(dur).count() << " ";
+    if (a[N / 2] != sorted[N / 2]) throw "Something's wrong";
+    for (unsigned int i = 0; i < 100 && i < N; ++i) if (best[i] != sorted[N - 1 - i]) throw "Something's wrong";
+}
+
+
+template<typename TP>
+void test_transpose(const vector<unsigned int> &in) {
+    // Transpose the input as a rows x cols matrix, tile by tile.
+    size_t cols = 1000;
+    size_t rows = N / cols;
+    vector<unsigned int> out(rows * cols);
+    auto side = tile_side_for(sizeof(unsigned int), 2);
+    steady_clock::time_point tim = steady_clock::now();
+    for (unsigned int i = 0; i < M; ++i) {
+        parallel_for_tiled(TP::instance, blocked_range2d<size_t>{0, rows, side, 0, cols, side},
+                           [&](const blocked_range2d<size_t> &tile) {
+                               for (auto r = tile.rows().begin(); r != tile.rows().end(); ++r)
+                                   for (auto c = tile.cols().begin(); c != tile.cols().end(); ++c)
+                                       out[c * rows + r] = in[r * cols + c];
+                           });
+    }
+    auto dur = steady_clock::now() - tim;
+    cout << "transpose " << duration_cast<milliseconds>(dur).count() << " ";
+    for (size_t r = 0; r < rows; ++r)
+        for (size_t c = 0; c < cols; ++c) if (out[c * rows + r] != in[r * cols + c]) throw "Something's wrong";
+    // Again in row-major order, with tiles that do not divide the matrix.
+    fill(out.begin(), out.end(), 0);
+    parallel_for_tiled(TP::instance, blocked_range2d<size_t>{0, rows, 7, 0, cols, 7},
+                       [&](const blocked_range2d<size_t> &tile) {
+                           for (auto r = tile.rows().begin(); r != tile.rows().end(); ++r)
+                               for (auto c = tile.cols().begin(); c != tile.cols().end(); ++c)
+                                   out[c * rows + r] = in[r * cols + c];
+                       }, tile_order::row_major);
+    for (size_t r = 0; r < rows; ++r)
+        for (size_t c = 0; c < cols; ++c) if (out[c * rows + r] != in[r * cols + c]) throw "Something's wrong";
+    // A blocked_range3d split all the way down visits every cell exactly once.
+    size_t pages = 6, height = 30, width = 50;
+    vector<atomic<unsigned int>> visits(pages * height * width);
+    parallel_for(TP::instance, blocked_range3d<size_t>{0, pages, 1, 0, height, 4, 0, width, 8},
+                 [&](const blocked_range3d<size_t> &box) {
+                     for (auto p = box.pages().begin(); p != box.pages().end(); ++p)
+                         for (auto r = box.rows().begin(); r != box.rows().end(); ++r)
+                             for (auto c = box.cols().begin(); c != box.cols().end(); ++c)
+                                 visits[(p * height + r) * width + c].fetch_add(1);
+                 }, simple_partitioner{});
+    for (auto &v : visits) if (v.load() != 1) throw "Something's wrong";
+}
+
+
+template<typename TP>
+void test_parallel_algorithm(TP &tp, const vector<unsigned int> &in, const vector<unsigned int> &expected, uint64_t expected_sum) {
+    // Each against its std counterpart. in[i] is i.
+    auto policy = par(tp);
+    steady_clock::time_point tim = steady_clock::now();
+    vector<unsigned int> a(in), b(N), c(N);
+    juwhan::for_each(policy, a.begin(), a.end(), [](unsigned int &x) { x = work(x); });
+    if (a != expected) throw "Something's wrong";
+    if (juwhan::transform(policy, in.begin(), in.end(), b.begin(), work) != b.end() || b != expected) throw "Something's wrong";
+    auto mix = [](unsigned int x, unsigned int y) { return x ^ y; };
+    juwhan::transform(policy, in.begin(), in.end(), expected.begin(), b.begin(), mix);
+    std::transform(in.begin(), in.end(), expected.begin(), c.begin(), mix);
+    if (b != c) throw "Something's wrong";
+    auto sum = juwhan::transform_reduce(policy, in.begin(), in.end(), uint64_t{7},
+                                        [](uint64_t x, uint64_t y) { return x + y; },
+                                        [](unsigned int x) -> uint64_t { return work(x); });
+    if (sum != expected_sum + 7) throw "Something's wrong";
+    auto is_triple = [](unsigned int x) { return x % 3 == 0; };
+    if (juwhan::count_if(policy, expected.begin(), expected.end(), is_triple) !=
+        static_cast<size_t>(std::count_if(expected.begin(), expected.end(), is_triple)))
+        throw "Something's wrong";
+    // Every piece of the upper half matches at once, while the lowest match is an eighth of the way in.
+    auto is_late = [](unsigned int x) { return x == N / 8 || x >= N / 2; };
+    if (juwhan::find_if(policy, in.begin(), in.end(), is_late) != std::find_if(in.begin(), in.end(), is_late))
+        throw "Something's wrong";
+    auto is_none = [](unsigned int x) { return x >= N; };
+    if (juwhan::find_if(policy, in.begin(), in.end(), is_none) != in.end()) throw "Something's wrong";
+    auto is_even = [](unsigned int x) { return x % 2 == 0; };
+    auto is_any = [](unsigned int x) { return x < N; };
+    if (juwhan::any_of(policy, in.begin(), in.end(), is_even) != std::any_of(in.begin(), in.end(), is_even) ||
+        juwhan::any_of(policy, in.begin(), in.end(), is_none) != std::any_of(in.begin(), in.end(), is_none) ||
+        juwhan::all_of(policy, in.begin(), in.end(), is_even) != std::all_of(in.begin(), in.end(), is_even) ||
+        juwhan::all_of(policy, in.begin(), in.end(), is_any) != std::all_of(in.begin(), in.end(), is_any) ||
+        juwhan::none_of(policy, in.begin(), in.end(), is_even) != std::none_of(in.begin(), in.end(), is_even) ||
+        juwhan::none_of(policy, in.begin(), in.end(), is_none) != std::none_of(in.begin(), in.end(), is_none))
+        throw "Something's wrong";
+    // copy_if keeps the order of the input.
+    auto b_end = juwhan::copy_if(policy, expected.begin(), expected.end(), b.begin(), is_triple);
+    auto c_end = std::copy_if(expected.begin(), expected.end(), c.begin(), is_triple);
+    if (b_end - b.begin() != c_end - c.begin() || !std::equal(c.begin(), c_end, b.begin())) throw "Something's wrong";
+    auto dur = steady_clock::now() - tim;
+    cout << "algorithm " << duration_cast<milliseconds>(dur).count() << " ";
+}
+
+
+template<typename TP>
+void test_affinity(TP &tp, const vector<unsigned int> &in, const vector<unsigned int> &expected) {
+    // The same loop again and again with one record. From the second run on, pieces go back to their workers through mail.
+    vector<unsigned int> out(N);
+    affinity_partitioner ap;
+    auto mailed = tp.mail_count();
+    steady_clock::time_point tim = steady_clock::now();
+    for (unsigned int i = 0; i < 10; ++i) {
+        fill(out.begin(), out.end(), 0);
+        parallel_for(tp, blocked_range<size_t>{0, N, 1024}, [&](const blocked_range<size_t> &r) {
+            for (auto j = r.begin(); j != r.end(); ++j) out[j] = work(in[j]);
+        }, ap);
+        if (out != expected) throw "Something's wrong";
+    }
+    auto dur = steady_clock::now() - tim;
+    cout << "affinity " << duration_cast<milliseconds>(dur).count() << " ";
+    if (tp.mail_count() == mailed) throw "Something's wrong";
+}
+
+
+// The tests that need several workers, whatever the machine has.
+template<typename TP>
+void test_explicit_pool(TP &tp, const vector<unsigned int> &in, const vector<unsigned int> &expected, uint64_t expected_sum) {
+    test_parallel_algorithm(tp, in, expected, expected_sum);
+    test_affinity(tp, in, expected);
+    test_channel(tp, in, expected_sum);
+    cout << endl;
+}
+
+
+template<typename TP>
+void test_pool(const vector<unsigned int> &in, const vector<unsigned int> &expected, uint64_t expected_sum) {
+    test_parallel_for<TP>("static", in, expected, static_partitioner{});
+    test_parallel_for<TP>("simple", in, expected, simple_partitioner{});
+    test_parallel_for<TP>("auto", in, expected, auto_partitioner{});
+    test_parallel_for<TP>("affinity", in, expected, affinity_partitioner{});
+    test_lazy_parallel_for<TP>(in, expected);
+    test_parallel_reduce<TP>(in, expected_sum);
+    test_divide_and_conquer<TP>(in, expected, expected_sum);
+    test_parallel_do<TP>(in, expected_sum);
+    test_parallel_pipeline<TP>(in, expected);
+    test_strand<TP>(in, expected_sum);
+    test_task_mutex<TP>(in, expected_sum);
+    test_parallel_scan<TP>(in);
+    test_selection<TP>(expected);
+    test_transpose<TP>(in);
+    cout << endl;
+}
+
+
+int main(int argc, char *argv[]) {
+    if (argc >= 3) {
+        N = atoll(argv[1]);
+        M = atoll(argv[2]);
+    }
+
+    vector<unsigned int> in(N), expected(N);
+    for (unsigned int i = 0; i < N; ++i) in[i] = i;
+
+    // Serial case.
+    steady_clock::time_point tim = steady_clock::now();
+    for (unsigned int i = 0; i < M; ++i) {
+        for (unsigned int j = 0; j < N; ++j) expected[j] = work(in[j]);
+    }
+    auto dur = steady_clock::now() - tim;
+    cout << "serial " << duration_cast<milliseconds>(dur).count() << endl;
+    uint64_t expected_sum{0};
+    for (unsigned int j = 0; j < N; ++j) expected_sum += expected[j];
+
+    test_pool<threadpool>(in, expected, expected_sum);
+    threadpool::instance.destroy();
+
+    greedy_threadpool::instance.go();
+    test_pool<greedy_threadpool>(in, expected, expected_sum);
+    greedy_threadpool::instance.destroy();
+
+    {
+        threadpool tp{4};
+        test_explicit_pool(tp, in, expected, expected_sum);
+    }
+    {
+        greedy_threadpool tp{4};
+        tp.go();
+        test_explicit_pool(tp, in, expected, expected_sum);
+        tp.stop();
+    }
+
+    return 0;
+}
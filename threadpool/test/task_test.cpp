@@ -0,0 +1,391 @@
+#include <iostream>
+#include <stdexcept>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include "threadpool.h"
+#include "greedy_threadpool.h"
+#include "task_group.h"
+#include "continuation.h"
+#include "task_graph.h"
+#include "static_task_graph.h"
+#include "task_sync.h"
+
+using namespace juwhan;
+using namespace std;
+
+// Tests of the task level features of the pools, each run on an explicit pool of several threads.
+
+
+static atomic<size_t> handled{0};
+static string last_handled;
+
+void count_handled(std::exception &e) {
+    last_handled = e.what();
+    handled.fetch_add(1);
+}
+
+
+template<typename TP>
+void test_post(TP &tp) {
+    // Posted tasks have no receipt. The one that throws reaches the handler, whatever it throws.
+    const size_t n = 1000;
+    atomic<size_t> done{0};
+    handled = 0;
+    tp.set_exception_handler(count_handled);
+    for (size_t i = 0; i < n; ++i) tp.post([&done] { done.fetch_add(1); });
+    tp.post([] { throw runtime_error("posted"); });
+    tp.help_until([&] { return done.load() == n && handled.load() == 1; });
+    if (last_handled != "posted") throw "Something's wrong";
+    tp.post([] { throw 1; });
+    tp.help_until([] { return handled.load() == 2; });
+    tp.set_exception_handler(nullptr);
+    cout << "post ok ";
+}
+
+
+template<typename TP>
+uint64_t group_fib(TP &tp, unsigned int n) {
+    if (n < 2) return n;
+    uint64_t left, right;
+    task_group<TP> group{tp};
+    auto l = group.make_child([&] { left = group_fib(tp, n - 1); });
+    auto r = group.make_child([&] { right = group_fib(tp, n - 2); });
+    group.run(l);
+    group.run_inline(r);
+    group.wait();
+    return left + right;
+}
+
+
+template<typename TP>
+void test_task_group(TP &tp) {
+    if (group_fib(tp, 20) != 6765) throw "Something's wrong";
+    // The first exception of the children comes out of wait().
+    {
+        task_group<TP> group{tp};
+        atomic<size_t> done{0};
+        auto a = group.make_child([&] { done.fetch_add(1); });
+        auto b = group.make_child([] { throw runtime_error("child"); });
+        auto c = group.make_child([&] { done.fetch_add(1); });
+        group.run(a);
+        group.run(b);
+        group.run(c);
+        bool is_thrown{false};
+        try { group.wait(); }
+        catch (runtime_error &e) { is_thrown = string(e.what()) == "child"; }
+        if (!is_thrown || done.load() != 2) throw "Something's wrong";
+    }
+    // A child that throws something other than a ::std::exception comes out of wait() as a runtime_error.
+    {
+        task_group<TP> group{tp};
+        auto a = group.make_child([] { throw 1; });
+        group.run(a);
+        bool is_thrown{false};
+        try { group.wait(); }
+        catch (runtime_error &) { is_thrown = true; }
+        if (!is_thrown) throw "Something's wrong";
+    }
+    // The destructor joins a group that was never waited for.
+    atomic<size_t> done{0};
+    {
+        task_group<TP> group{tp};
+        auto a = group.make_child([&] { done.fetch_add(1); });
+        auto b = group.make_child([&] { done.fetch_add(1); });
+        group.run(a);
+        group.run(b);
+    }
+    if (done.load() != 2) throw "Something's wrong";
+    // parallel_invoke.
+    unsigned int x{0}, y{0}, z{0};
+    parallel_invoke(tp, [&] { x = 1; }, [&] { y = 2; }, [&] { z = 3; });
+    if (x != 1 || y != 2 || z != 3) throw "Something's wrong";
+    cout << "task_group ok ";
+}
+
+
+template<typename TP>
+void test_continuation(TP &tp) {
+    // A chain of then().
+    auto chained = tp.submit([] { return 2; }).then([](int x) { return x * 3; }).then([](int x) { return x + 1; });
+    if (chained.get() != 7) throw "Something's wrong";
+    // when_all and when_any over a mix of ready and pending receipts.
+    atomic<bool> is_released{false};
+    auto pending = [&is_released] {
+        while (!is_released.load()) std::this_thread::yield();
+        return 1;
+    };
+    typename TP::template receipt_type<int> mixed[3];
+    mixed[0] = tp.submit(pending);
+    mixed[1] = tp.submit([] { return 2; });
+    mixed[1].get();
+    mixed[2] = tp.submit(pending);
+    auto any = when_any(mixed, mixed + 3);
+    if (any.get() != 1) throw "Something's wrong";
+    auto all = when_all(mixed, mixed + 3);
+    is_released = true;
+    all.get();
+    if (mixed[0].get() != 1 || mixed[2].get() != 1) throw "Something's wrong";
+    // An exceptional input makes when_all exceptional, and skips then().
+    typename TP::template receipt_type<int> inputs[2];
+    inputs[0] = tp.submit([] { return 1; });
+    inputs[1] = tp.submit([]() -> int { throw runtime_error("input"); });
+    auto skipped = inputs[1].then([](int x) { return x + 1; });
+    bool is_thrown{false};
+    try { when_all(inputs, inputs + 2).get(); }
+    catch (runtime_error &e) { is_thrown = string(e.what()) == "input"; }
+    if (!is_thrown) throw "Something's wrong";
+    is_thrown = false;
+    try { skipped.get(); }
+    catch (runtime_error &e) { is_thrown = string(e.what()) == "input"; }
+    if (!is_thrown) throw "Something's wrong";
+    // when_any has nothing to pick from an empty range.
+    is_thrown = false;
+    try { when_any(inputs, inputs); }
+    catch (runtime_error &) { is_thrown = true; }
+    if (!is_thrown) throw "Something's wrong";
+    cout << "continuation ok ";
+}
+
+
+template<typename TP>
+void test_task_graph(TP &tp) {
+    // Every node stamps the order it ran in. Each edge must go from a lower stamp to a higher one, run after run.
+    const size_t n = 6;
+    const size_t edges[][2] = {{0, 1}, {0, 2}, {1, 3}, {2, 3}, {3, 4}, {1, 5}, {5, 4}};
+    atomic<size_t> clock{0};
+    size_t stamps[n];
+    task_graph<TP> g{tp};
+    typename task_graph<TP>::node *nodes[n];
+    for (size_t i = 0; i < n; ++i) nodes[i] = g.emplace([&clock, &stamps, i] { stamps[i] = clock.fetch_add(1); });
+    for (auto &e : edges) nodes[e[0]]->precede(nodes[e[1]]);
+    for (size_t r = 0; r < 10; ++r) {
+        size_t start = clock.load();
+        g.run();
+        if (clock.load() != start + n) throw "Something's wrong";
+        for (auto &e : edges) if (stamps[e[0]] >= stamps[e[1]] || stamps[e[0]] < start) throw "Something's wrong";
+    }
+    // A cycle is rejected before anything runs.
+    task_graph<TP> cyclic{tp};
+    auto a = cyclic.emplace([&clock] { clock.fetch_add(1); });
+    auto b = cyclic.emplace([&clock] { clock.fetch_add(1); });
+    auto c = cyclic.emplace([&clock] { clock.fetch_add(1); });
+    a->precede(b);
+    b->precede(c);
+    c->precede(a);
+    size_t before = clock.load();
+    bool is_thrown{false};
+    try { cyclic.run(); }
+    catch (runtime_error &) { is_thrown = true; }
+    if (!is_thrown || clock.load() != before) throw "Something's wrong";
+    // A node that throws something other than a ::std::exception comes out of run() as a runtime_error. Its successor still runs.
+    task_graph<TP> throwing{tp};
+    auto d = throwing.emplace([] { throw 1; });
+    auto e = throwing.emplace([&clock] { clock.fetch_add(1); });
+    d->precede(e);
+    before = clock.load();
+    is_thrown = false;
+    try { throwing.run(); }
+    catch (runtime_error &) { is_thrown = true; }
+    if (!is_thrown || clock.load() != before + 1) throw "Something's wrong";
+    cout << "task_graph ok ";
+}
+
+
+template<typename TP>
+void test_static_task_graph(TP &tp) {
+    // A diamond. Both middle nodes run after the top and before the bottom, run after run.
+    atomic<size_t> clock{0};
+    size_t stamps[4];
+    auto g = make_static_task_graph<edges<edge<0, 1>, edge<0, 2>, edge<1, 3>, edge<2, 3>>>(
+            tp,
+            [&] { stamps[0] = clock.fetch_add(1); },
+            [&] { stamps[1] = clock.fetch_add(1); },
+            [&] { stamps[2] = clock.fetch_add(1); },
+            [&] { stamps[3] = clock.fetch_add(1); });
+    for (size_t r = 0; r < 10; ++r) {
+        size_t start = clock.load();
+        g.run();
+        if (clock.load() != start + 4 || stamps[0] != start || stamps[3] != start + 3) throw "Something's wrong";
+        if (stamps[1] == stamps[2] || stamps[1] <= start || stamps[2] <= start) throw "Something's wrong";
+    }
+    // A node that throws something other than a ::std::exception comes out of run() as a runtime_error. Its successor still runs.
+    auto throwing = make_static_task_graph<edges<edge<0, 1>>>(tp, [] { throw 1; }, [&] { clock.fetch_add(1); });
+    size_t before = clock.load();
+    bool is_thrown{false};
+    try { throwing.run(); }
+    catch (runtime_error &) { is_thrown = true; }
+    if (!is_thrown || clock.load() != before + 1) throw "Something's wrong";
+    cout << "static_task_graph ok ";
+}
+
+
+void test_captured_graph(threadpool &tp) {
+    // A receipt passed to a later submission makes an edge. The graph is replayed with the inputs of the time.
+    captured_graph<threadpool> g{tp};
+    int source{0};
+    tp.begin_capture(g);
+    auto a = tp.submit([&source] { return source; });
+    auto b = tp.submit([](threadpool_receit<int> x) { return x.get() * 10; }, a);
+    auto c = tp.submit([](threadpool_receit<int> x) { return x.get() + 1; }, b);
+    tp.end_capture();
+    if (g.size() != 3 || tp.my_capture()) throw "Something's wrong";
+    for (int r = 1; r <= 2; ++r) {
+        source = r;
+        g.replay();
+        if (c.get() != r * 10 + 1) throw "Something's wrong";
+    }
+    cout << "captured_graph ok ";
+}
+
+
+// A result that is never set frees its continuations with it. Run it under a leak checker.
+void test_unset_continuation() {
+    greedy_threadpool tp{2};
+    // The pool never goes, and the task is flushed at destroy().
+    auto never = tp.submit([] { return 1; });
+    auto next = never.then([](int x) { return x + 1; });
+    auto all = when_all(&never, &never + 1);
+    auto any = when_any(&next, &next + 1);
+    cout << "unset continuation ok" << endl;
+}
+
+
+template<typename TP>
+uint64_t heartbeat_fib(TP &tp, unsigned int n) {
+    if (n < 2) return n;
+    auto left = tp.submit([&tp, n] { return heartbeat_fib(tp, n - 1); });
+    auto right = heartbeat_fib(tp, n - 2);
+    return left.get() + right;
+}
+
+
+template<typename TP>
+void test_heartbeat(TP &tp) {
+    tp.set_heartbeat(50);
+    if (heartbeat_fib(tp, 20) != 6765) throw "Something's wrong";
+    // A beat comes due while this thread waits, with no submit in between. The wait promotes the oldest latent task.
+    tp.set_heartbeat(100000);
+    tp.submit([] {}).get();
+    tp.submit([] {}).get();
+    auto promoted = tp.promoted_count();
+    auto older = tp.submit([] { return 1; });
+    auto newer = tp.submit([] { return 2; });
+    if (tp.promoted_count() != promoted) throw "Something's wrong";
+    std::this_thread::sleep_for(std::chrono::milliseconds{150});
+    if (older.get() != 1 || newer.get() != 2) throw "Something's wrong";
+    if (tp.promoted_count() == promoted) throw "Something's wrong";
+    tp.set_heartbeat(0);
+    cout << "heartbeat ok ";
+}
+
+
+template<typename TP>
+uint64_t spawn_fib(TP &tp, unsigned int n) {
+    if (n < 2) return n;
+    auto left = tp.spawn_or_run([&tp, n] { return spawn_fib(tp, n - 1); });
+    auto right = spawn_fib(tp, n - 2);
+    return left.get() + right;
+}
+
+
+template<typename TP>
+void test_spawn_or_run(TP &tp) {
+    // fib(20) calls spawn_or_run once per call with n >= 2, 10945 times.
+    // With no threshold, a spawn is run in place whenever the queue is not empty and nobody asks for work.
+    tp.set_inline_threshold(0);
+    tp.reset_spawn_stats();
+    if (spawn_fib(tp, 20) != 6765) throw "Something's wrong";
+    auto stats = tp.spawn_stats();
+    if (stats.inline_threshold != 0 || stats.inlined == 0 || stats.spawned + stats.inlined != 10945) throw "Something's wrong";
+    // With a threshold no queue reaches, everything is spawned.
+    tp.set_inline_threshold(static_cast<size_t>(-1));
+    tp.reset_spawn_stats();
+    if (spawn_fib(tp, 20) != 6765) throw "Something's wrong";
+    stats = tp.spawn_stats();
+    if (stats.inline_threshold != static_cast<size_t>(-1) || stats.inlined != 0 || stats.spawned != 10945) throw "Something's wrong";
+    tp.set_inline_threshold(JUWHAN_INLINE_THRESHOLD);
+    cout << "spawn_or_run ok ";
+}
+
+
+template<typename TP>
+void test_task_sync(TP &tp) {
+    // A latch over posted tasks. wait() returns once all of them have counted down.
+    const size_t n = 200;
+    atomic<size_t> done{0};
+    {
+        task_latch<TP> latch{tp, n};
+        for (size_t i = 0; i < n; ++i) tp.post([&] { done.fetch_add(1); latch.count_down(); });
+        latch.wait();
+        if (done.load() != n) throw "Something's wrong";
+    }
+    // A semaphore of two. No more than two tasks are ever past acquire at once.
+    task_semaphore<TP> semaphore{tp, 2};
+    task_latch<TP> finished{tp, n};
+    atomic<size_t> active{0}, most{0};
+    for (size_t i = 0; i < n; ++i) {
+        tp.post([&] {
+            semaphore.acquire();
+            auto now = active.fetch_add(1) + 1;
+            auto seen = most.load();
+            while (now > seen && !most.compare_exchange_weak(seen, now));
+            for (auto k = 0; k < 8; ++k) std::this_thread::yield();
+            active.fetch_sub(1);
+            semaphore.release();
+            finished.count_down();
+        });
+    }
+    finished.wait();
+    if (most.load() == 0 || most.load() > 2 || active.load() != 0) throw "Something's wrong";
+    // A parked wait in heartbeat mode. The task counting down is latent on this thread, and parking hands it to the others.
+    tp.set_heartbeat(1000000);
+    tp.submit([] {}).get();
+    {
+        task_latch<TP> latch{tp, 1};
+        tp.submit([&] { latch.count_down(); });
+        auto &depth = tp.my_wait_depth();
+        auto saved = depth;
+        depth = JUWHAN_TASK_WAIT_DEPTH;
+        latch.wait();
+        depth = saved;
+    }
+    tp.set_heartbeat(0);
+    cout << "task_sync ok ";
+}
+
+
+template<typename TP>
+void test_pool(TP &tp) {
+    test_post(tp);
+    test_task_group(tp);
+    test_continuation(tp);
+    test_heartbeat(tp);
+    test_spawn_or_run(tp);
+    test_task_sync(tp);
+    test_task_graph(tp);
+    test_static_task_graph(tp);
+    cout << endl;
+}
+
+
+int main() {
+    {
+        threadpool tp{4};
+        test_pool(tp);
+        test_captured_graph(tp);
+        cout << endl;
+    }
+    {
+        greedy_threadpool tp{4};
+        tp.go();
+        test_pool(tp);
+        tp.stop();
+    }
+    test_unset_continuation();
+    return 0;
+}
@@ -4,9 +4,15 @@
 #include <chrono>
 #include <time.h>
 #include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
 
 #include "threadpool.h"
 #include "greedy_threadpool.h"
+#include "parallel_sort.h"
+#include "parallel_radix_sort.h"
 
 using namespace juwhan;
 using namespace std;
@@ -110,6 +116,59 @@ void parallel_qsort(unsigned int array[], unsigned int begin, unsigned int end)
 #undef pivot_index
 
 
+// Time M rounds of sorting a copy of arr0 into out, and print the milliseconds.
+template<typename S>
+void measure_sort(S sort, std::vector<unsigned int> &arr0, std::vector<unsigned int> &out) {
+    steady_clock::time_point tim = steady_clock::now();
+    for (unsigned int i = 0; i < M; ++i) {
+        out = arr0;
+        sort(out);
+    }
+    auto dur = steady_clock::now() - tim;
+    cout << duration_cast<milliseconds>(dur).count() << " ";
+}
+
+
+// Sort with comparators, against the std counterparts.
+template<typename TP>
+void check_sorts_with_comparators(TP &tp, std::vector<unsigned int> &arr0) {
+    // Few distinct keys, so stability shows. The second of a pair is the original position.
+    typedef std::pair<unsigned int, unsigned int> keyed;
+    std::vector<keyed> a(arr0.size());
+    for (unsigned int i = 0; i < a.size(); ++i) a[i] = keyed{arr0[i] % 100, i};
+    std::vector<keyed> b(a);
+    auto by_key = [](const keyed &x, const keyed &y) { return x.first < y.first; };
+    std::stable_sort(a.begin(), a.end(), by_key);
+    parallel_stable_sort(tp, b.begin(), b.end(), by_key);
+    if (a != b) throw "Something's wrong";
+    // Descending.
+    std::vector<unsigned int> c(arr0), d(arr0);
+    std::sort(c.begin(), c.end(), std::greater<unsigned int>{});
+    parallel_sort(tp, d.begin(), d.end(), std::greater<unsigned int>{});
+    if (c != d) throw "Something's wrong";
+}
+
+
+// Radix sort 64 bit keys with values, against std::stable_sort of the pairs.
+template<typename TP>
+void check_radix_sort_with_values(TP &tp, std::vector<unsigned int> &arr0) {
+    // Keys use the high bits and repeat a lot. The value is the original position.
+    typedef std::pair<uint64_t, unsigned int> keyed;
+    std::vector<keyed> pairs(arr0.size());
+    std::vector<uint64_t> keys(arr0.size());
+    std::vector<unsigned int> values(arr0.size());
+    for (unsigned int i = 0; i < arr0.size(); ++i) {
+        keys[i] = (uint64_t{arr0[i] % 1000} << 40) | (arr0[i] % 7);
+        values[i] = i;
+        pairs[i] = keyed{keys[i], i};
+    }
+    std::stable_sort(pairs.begin(), pairs.end(), [](const keyed &x, const keyed &y) { return x.first < y.first; });
+    parallel_radix_sort(tp, keys.begin(), keys.end(), values.begin());
+    for (unsigned int i = 0; i < pairs.size(); ++i)
+        if (keys[i] != pairs[i].first || values[i] != pairs[i].second) throw "Something's wrong";
+}
+
+
 int main(int argc, char *argv[]) {
     if (argc >= 4) {
         N = atoll(argv[1]);
@@ -141,6 +200,11 @@ int main(int argc, char *argv[]) {
     // cout << endl;
 
 
+    // std::sort, the baseline for parallel_sort.
+    // Note that the qsorts above leave out the last element, so parallel_sort is verified against this one.
+    std::vector<unsigned int> arr_s(N), arr_q(N);
+    measure_sort([](std::vector<unsigned int> &a) { std::sort(a.begin(), a.end()); }, arr0, arr_s);
+
     // Parallel case.
     //
     // Measure time now.
@@ -158,6 +222,25 @@ int main(int argc, char *argv[]) {
     // for(auto i=0; i<N; ++i) cout << " " << arr[i];
     // cout << endl;
 
+    // parallel_sort and parallel_stable_sort.
+    measure_sort([](std::vector<unsigned int> &a) { parallel_sort(threadpool::instance, a.begin(), a.end()); }, arr0, arr_q);
+    for (unsigned int i = 0; i < N; ++i) if (arr_s[i] != arr_q[i]) throw "Something's wrong";
+    measure_sort([](std::vector<unsigned int> &a) { parallel_stable_sort(threadpool::instance, a.begin(), a.end()); }, arr0, arr_q);
+    for (unsigned int i = 0; i < N; ++i) if (arr_s[i] != arr_q[i]) throw "Something's wrong";
+    check_sorts_with_comparators(threadpool::instance, arr0);
+    measure_sort([](std::vector<unsigned int> &a) { parallel_radix_sort(threadpool::instance, a.begin(), a.end()); }, arr0, arr_q);
+    for (unsigned int i = 0; i < N; ++i) if (arr_s[i] != arr_q[i]) throw "Something's wrong";
+    check_radix_sort_with_values(threadpool::instance, arr0);
+
+    // The parallel qsort again in heartbeat mode, spawning down to the smallest ranges.
+    auto plim = PLIM;
+    PLIM = 1;
+    threadpool::instance.set_heartbeat(100);
+    measure_sort([](std::vector<unsigned int> &a) { parallel_qsort<threadpool>(a.data(), 0, N - 1); }, arr0, arr_q);
+    threadpool::instance.set_heartbeat(0);
+    PLIM = plim;
+    for (unsigned int i = 0; i < N; ++i) if (arr[i] != arr_q[i]) throw "Something's wrong";
+
     threadpool::instance.destroy();
 
     // Verify.
@@ -182,12 +265,29 @@ int main(int argc, char *argv[]) {
     // for(unsigned int i=0; i<N; ++i) cout << " " << arr[i];
     // cout << endl;
 
+    // parallel_sort and parallel_stable_sort.
+    measure_sort([](std::vector<unsigned int> &a) { parallel_sort(greedy_threadpool::instance, a.begin(), a.end()); }, arr0, arr_q);
+    for (unsigned int i = 0; i < N; ++i) if (arr_s[i] != arr_q[i]) throw "Something's wrong";
+    measure_sort([](std::vector<unsigned int> &a) { parallel_stable_sort(greedy_threadpool::instance, a.begin(), a.end()); }, arr0, arr_q);
+    for (unsigned int i = 0; i < N; ++i) if (arr_s[i] != arr_q[i]) throw "Something's wrong";
+    check_sorts_with_comparators(greedy_threadpool::instance, arr0);
+    measure_sort([](std::vector<unsigned int> &a) { parallel_radix_sort(greedy_threadpool::instance, a.begin(), a.end()); }, arr0, arr_q);
+    for (unsigned int i = 0; i < N; ++i) if (arr_s[i] != arr_q[i]) throw "Something's wrong";
+    check_radix_sort_with_values(greedy_threadpool::instance, arr0);
+
     greedy_threadpool::instance.destroy();
 
     // Verify.
     for (unsigned int i = 0; i < N; ++i) if (arr[i] != arr_p[i]) throw "Something's wrong";
     //cout << "The result verification passes OK." << endl;
 
+    // The checks again with several workers, whatever the machine has, so that the sorts work on more than one block.
+    {
+        threadpool tp{4};
+        check_sorts_with_comparators(tp, arr0);
+        check_radix_sort_with_values(tp, arr0);
+    }
+
     return 0;
 }
 
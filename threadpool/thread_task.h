@@ -2,30 +2,39 @@
 #define juwhan_thread_task_h
 
 #include <exception>
+#include <stdexcept>
 #include <cstdlib>
 #include <atomic>
 #include "aligned_circular_array.h"
 #include "juwhan_std.h"
 #include "fast_function.h"
-
-#define PARAM0
-#define PARAM1 this->arg1
-#define PARAM2 PARAM1, this->arg2
-#define PARAM3 PARAM2, this->arg3
-#define PARAM4 PARAM3, this->arg4
-#define PARAM5 PARAM4, this->arg5
-#define PARAM6 PARAM5, this->arg6
-#define PARAM7 PARAM6, this->arg7
-#define PARAM8 PARAM7, this->arg8
-#define PARAM9 PARAM8, this->arg9
-#define PARAM10 PARAM9, this->arg10
-#define FUNC_MACRO(N) func(PARAM##N)
+#include "argument_storage.h"
 
 // This header file defines a variable length thread_task class.
 
 namespace juwhan {
 
 
+// Forward declaration.
+    struct function_return_type_base_implementation;
+
+// A callback fired once, when a function return type is set.
+// Continuations registered on a result(then, when_all, when_any) are built on this.
+    struct function_return_continuation {
+        function_return_continuation *next;
+
+        function_return_continuation() : next{nullptr} {};
+
+        // The source is the result that has just been set.
+        virtual void fire(function_return_type_base_implementation &source) = 0;
+
+        // Called instead of fire, when the result goes away without ever being set(e.g. its task was flushed at destroy()).
+        virtual void drop() {};
+
+        virtual ~function_return_continuation() {};
+    };
+
+
 // Function return type.
     struct function_return_type_base_implementation {
         ::std::atomic<size_t> _shared_count;
@@ -34,11 +43,31 @@ namespace juwhan {
         char pad1[JUWHAN_CACHELINE_SIZE];
         ::std::atomic<bool> _is_exceptional;
         char pad2[JUWHAN_CACHELINE_SIZE];
-        ::std::exception *e;
+        ::std::atomic<function_return_continuation *> continuations;
+        ::std::runtime_error *e;
 
-        function_return_type_base_implementation() : _shared_count{}, _is_set{} {
+        // Marks the continuation list as fired. Continuations added afterwards fire right away.
+        static function_return_continuation *closed() {
+            return reinterpret_cast<function_return_continuation *>(1);
+        };
+
+        function_return_type_base_implementation()
+                : _shared_count{}, _is_set{}, _is_exceptional{}, continuations{nullptr}, e{nullptr} {
             _shared_count.store(0, ::std::memory_order_relaxed);
             _is_set.store(false, ::std::memory_order_relaxed);
+            _is_exceptional.store(false, ::std::memory_order_relaxed);
+        };
+
+        ~function_return_type_base_implementation() {
+            // Continuations that never fired are dropped.
+            auto c = continuations.load(::std::memory_order_acquire);
+            while (c && c != closed()) {
+                auto next = c->next;
+                c->drop();
+                delete c;
+                c = next;
+            }
+            delete e;
         };
 
         function_return_type_base_implementation(function_return_type_base_implementation &other) = delete;
@@ -59,19 +88,32 @@ namespace juwhan {
 
         void unshare() { _shared_count.fetch_sub(1, ::std::memory_order_relaxed); };
 
-        void set() { _is_set.store(true, ::std::memory_order_relaxed); };
+        // Drop one holder. Returns true for the last holder, who must delete the result.
+        bool release() { return _shared_count.fetch_sub(1, ::std::memory_order_acq_rel) == 0; };
 
-        void unset() { _is_set.store(false, ::std::memory_order_relaxed); };
+        void set() {
+            _is_set.store(true, ::std::memory_order_release);
+            fire_continuations();
+        };
+
+        // Make the result settable again. Continuations can be added anew.
+        void unset() {
+            _is_set.store(false, ::std::memory_order_relaxed);
+            _is_exceptional.store(false, ::std::memory_order_relaxed);
+            continuations.store(nullptr, ::std::memory_order_release);
+        };
 
         bool is_shared() { return (_shared_count.load(::std::memory_order_relaxed) == 0) ? false : true; };
 
-        bool is_set() { return _is_set.load(::std::memory_order_relaxed); };
+        bool is_set() { return _is_set.load(::std::memory_order_acquire); };
 
         size_t shared_count() { return _shared_count.load(::std::memory_order_relaxed); };
 
         // Exception handling.
+        // The caught exception dies with its catch block, so keep a copy of the message.
         void set_exception(::std::exception &e_) {
-            e = &e_;
+            delete e;
+            e = new ::std::runtime_error(e_.what());
             _is_exceptional.store(true, ::std::memory_order_relaxed);
             set();
         };
@@ -79,6 +121,41 @@ namespace juwhan {
         bool is_exceptional() { return _is_exceptional.load(::std::memory_order_relaxed); };
 
         ::std::exception &get_exception() { return *e; };
+
+        // Continuations.
+        // Fire once the result is set. Continuations are fired in the order they were added.
+        void add_continuation(function_return_continuation *c) {
+            auto head = continuations.load(::std::memory_order_acquire);
+            do {
+                if (head == closed()) {
+                    // Already set. Fire now.
+                    c->fire(*this);
+                    delete c;
+                    return;
+                }
+                c->next = head;
+            } while (!continuations.compare_exchange_weak(head, c, ::std::memory_order_acq_rel,
+                                                          ::std::memory_order_acquire));
+        };
+
+        void fire_continuations() {
+            auto head = continuations.exchange(closed(), ::std::memory_order_acq_rel);
+            if (!head || head == closed()) return;
+            // Reverse the list, which was built last-in first.
+            function_return_continuation *ordered{nullptr};
+            while (head) {
+                auto next = head->next;
+                head->next = ordered;
+                ordered = head;
+                head = next;
+            }
+            while (ordered) {
+                auto next = ordered->next;
+                ordered->fire(*this);
+                delete ordered;
+                ordered = next;
+            }
+        };
     };
 
 
@@ -154,13 +231,9 @@ namespace juwhan {
         T get() const { return *value_ptr; };
 
         void destroy() {
-            if (base) {
-                if (base->is_shared()) {
-                    base->unshare();
-                } else {
-                    delete value_ptr;
-                    delete base;
-                }
+            if (base && base->release()) {
+                delete value_ptr;
+                delete base;
             }
         };
 
@@ -261,13 +334,9 @@ namespace juwhan {
         T &get() const { return **value_ptr; };
 
         void destroy() {
-            if (base) {
-                if (base->is_shared()) {
-                    base->unshare();
-                } else {
-                    delete value_ptr;
-                    delete base;
-                }
+            if (base && base->release()) {
+                delete value_ptr;
+                delete base;
             }
         };
 
@@ -329,13 +398,7 @@ namespace juwhan {
         operator bool() const { return base->is_set(); };
 
         void destroy() {
-            if (base) {
-                if (base->is_shared()) {
-                    base->unshare();
-                } else {
-                    delete base;
-                }
-            }
+            if (base && base->release()) delete base;
         };
 
         ~function_return_type() {
@@ -368,69 +431,24 @@ namespace juwhan {
     public:
         virtual void operator()() = 0;
 
-        virtual ~thread_task() {};
-    };
-
+        // Most tasks are allocated by make_task and deleted by the pool once run.
+        // A task owned by someone else(e.g. a child living in its parent's stack frame) returns false. The pool never touches such a task after running it.
+        virtual bool is_pool_owned() const { return true; };
 
-// Thread_task helper.
-    template<size_t N, typename H, typename... T>
-    struct thread_task_helper {
+        virtual ~thread_task() {};
     };
-#define T_T_H_MACRO(N) template<typename H, typename... T> struct thread_task_helper<N, H, T...> : thread_task_helper<N+1, T...> { using arg##N##_type = H; H arg##N; template<typename HH, typename... TT> thread_task_helper(HH&& head, TT&&... tail) : thread_task_helper<N+1, T...>{::juwhan::forward<TT>(tail)...}, arg##N(::juwhan::forward<HH>(head)) {}; };
-
-    T_T_H_MACRO(1);
-
-    T_T_H_MACRO(2);
-
-    T_T_H_MACRO(3);
-
-    T_T_H_MACRO(4);
-
-    T_T_H_MACRO(5);
 
-    T_T_H_MACRO(6);
 
-    T_T_H_MACRO(7);
-
-    T_T_H_MACRO(8);
-
-    T_T_H_MACRO(9);
-
-    T_T_H_MACRO(10);
-#undef T_T_H_MACRO
-
-// Base helper.
-#define T_T_H_MACRO(N) template<typename H> struct thread_task_helper<N, H> { static constexpr size_t arity = N; using arg##N##_type = H; H arg##N; template<typename HH> thread_task_helper(HH&& head) : arg##N(::juwhan::forward<HH>(head)) {}; };
-
-    T_T_H_MACRO(1);
-
-    T_T_H_MACRO(2);
-
-    T_T_H_MACRO(3);
-
-    T_T_H_MACRO(4);
-
-    T_T_H_MACRO(5);
-
-    T_T_H_MACRO(6);
-
-    T_T_H_MACRO(7);
-
-    T_T_H_MACRO(8);
-
-    T_T_H_MACRO(9);
-
-    T_T_H_MACRO(10);
-#undef T_T_H_MACRO
-
-
-// thread_task implementation, where the function takes parameters.
+// thread_task implementation.
+// The callable and the arguments are kept in an argument_storage; the callable at 0 and the arguments from 1 on.
     template<typename F, typename... A>
-    struct thread_task_implementation : thread_task_helper<1, A...>, public thread_task {
+    struct thread_task_implementation : public thread_task,
+                                        argument_storage<typename callable_storage<F>::type, A...> {
+        static constexpr size_t arity = sizeof...(A);
         using this_type = thread_task_implementation<F, A...>;
+        using storage_type = argument_storage<typename callable_storage<F>::type, A...>;
         using result_type = typename function_traits<F>::result_type;
         function_return_type<result_type> ret;
-        fast_function<typename function_type_deduction<F>::simplified_traits> func;
 
         // Use perfect ::juwhan::forwarding in constructors.
         // There are 3 executable types.
@@ -444,107 +462,28 @@ namespace juwhan {
                 function_type_deduction<typename decay<FF>::type>::is_static ||
                 function_type_deduction<typename decay<FF>::type>::is_functor>::type>
         thread_task_implementation(FF &&func_, AA &&... args)
-                : thread_task_helper<1, A...>(::juwhan::forward<AA>(args)...), func(::juwhan::forward<FF>(func_)) {};
+                : storage_type(::juwhan::forward<FF>(func_), ::juwhan::forward<AA>(args)...) {};
 
         // 2. The member function case.
         template<typename FF, typename T, typename... AA, typename = typename enable_if<function_type_deduction<typename decay<FF>::type>::is_member>::type>
         thread_task_implementation(FF &&func_, T &&this_, AA &&... args)
-                :  thread_task_helper<1, A...>(::juwhan::forward<AA>(args)...),
-                   func(::juwhan::forward<T>(this_), ::juwhan::forward<FF>(func_)) {};
-
-
-
-        // execute().
-#define EXE_MACRO(N) template<typename V = this_type> typename enable_if<V::arity==N && !is_same<void, result_type>::value>::type execute() { try { ret = FUNC_MACRO(N); } catch(::std::exception& e) { ret.set_exception(e); } catch(...) {} };
-
-        EXE_MACRO(1);
-
-        EXE_MACRO(2);
-
-        EXE_MACRO(3);
-
-        EXE_MACRO(4);
-
-        EXE_MACRO(5);
-
-        EXE_MACRO(6);
-
-        EXE_MACRO(7);
-
-        EXE_MACRO(8);
-
-        EXE_MACRO(9);
-
-        EXE_MACRO(10);
-#undef EXE_MACRO
-#define EXE_MACRO(N) template<typename V = this_type> typename enable_if<V::arity==N && is_same<void, result_type>::value>::type execute() { try{ FUNC_MACRO(N); ret.set(); } catch(::std::exception& e) { ret.set_exception(e); } catch(...) {} };
-
-        EXE_MACRO(1);
-
-        EXE_MACRO(2);
-
-        EXE_MACRO(3);
-
-        EXE_MACRO(4);
-
-        EXE_MACRO(5);
-
-        EXE_MACRO(6);
+                : storage_type(typename callable_storage<F>::type(::juwhan::forward<T>(this_), ::juwhan::forward<FF>(func_)),
+                               ::juwhan::forward<AA>(args)...) {};
 
-        EXE_MACRO(7);
 
-        EXE_MACRO(8);
-
-        EXE_MACRO(9);
-
-        EXE_MACRO(10);
-#undef EXE_MACRO
-
-
-        // Operator().
-        void operator()() {
-            execute();
+        // Call the stored callable with the stored arguments.
+        template<size_t... I>
+        result_type invoke(index_sequence<I...>) {
+            return this->template get<0>()(this->template get<I + 1>()...);
         };
 
 
-    };
-
-
-// thread_task implementation, where the function DOES NOT take parameters.
-    template<typename F>
-    struct thread_task_implementation<F> : public thread_task {
-        static constexpr size_t arity = 0;
-        using this_type = thread_task_implementation<F>;
-        using result_type = typename function_traits<F>::result_type;;
-        function_return_type<result_type> ret;
-        fast_function<typename function_type_deduction<F>::simplified_traits> func;
-
-
-        // Use perfect ::juwhan::forwarding in constructors.
-        // There are 3 executable types.
-        // 1. Static function.
-        // 2. Member class function.
-        // 3. A class with overridden operator(); including lambda functions.
-
-        // 1. The static and the functor case.
-        template<typename FF, typename = typename enable_if<
-                function_type_deduction<typename decay<FF>::type>::is_static ||
-                function_type_deduction<typename decay<FF>::type>::is_functor>::type>
-        thread_task_implementation(FF &&func_)
-                : func(::juwhan::forward<FF>(func_)) {};
-
-        // 2. The member function case.
-        template<typename FF, typename T, typename = typename enable_if<function_type_deduction<typename decay<FF>::type>::is_member>::type>
-        thread_task_implementation(FF &&func_, T &&this_)
-                :  func(::juwhan::forward<T>(this_), ::juwhan::forward<FF>(func_)) {};
-
-
         // Execute().
         // Returns something.
         template<typename V = this_type>
         typename enable_if<!is_same<void, typename V::result_type>::value>::type execute() {
             // This function returns a value.
-            try { ret = func(); }
+            try { ret.set(invoke(make_index_sequence<arity>{})); }
             catch (::std::exception &e) { ret.set_exception(e); }
             catch (...) {}
         };
@@ -554,7 +493,7 @@ namespace juwhan {
         typename enable_if<is_same<void, typename V::result_type>::value>::type execute() {
             // This function returns NOTHING.
             try {
-                func();
+                invoke(make_index_sequence<arity>{});
                 ret.set();
             }
             catch (::std::exception &e) { ret.set_exception(e); }
@@ -568,6 +507,61 @@ namespace juwhan {
 
     };
 
+// A detached thread_task. It carries no result and hands exceptions over to whoever runs it.
+// This is what a fire-and-forget submission(post) is made of.
+    template<typename F, typename... A>
+    struct detached_task_implementation : public thread_task,
+                                          argument_storage<typename callable_storage<F>::type, A...> {
+        static constexpr size_t arity = sizeof...(A);
+        using storage_type = argument_storage<typename callable_storage<F>::type, A...>;
+        using result_type = void;
+
+        // 1. The static and the functor case.
+        template<typename FF, typename... AA, typename = typename enable_if<
+                function_type_deduction<typename decay<FF>::type>::is_static ||
+                function_type_deduction<typename decay<FF>::type>::is_functor>::type>
+        detached_task_implementation(FF &&func_, AA &&... args)
+                : storage_type(::juwhan::forward<FF>(func_), ::juwhan::forward<AA>(args)...) {};
+
+        // 2. The member function case.
+        template<typename FF, typename T, typename... AA, typename = typename enable_if<function_type_deduction<typename decay<FF>::type>::is_member>::type>
+        detached_task_implementation(FF &&func_, T &&this_, AA &&... args)
+                : storage_type(typename callable_storage<F>::type(::juwhan::forward<T>(this_), ::juwhan::forward<FF>(func_)),
+                               ::juwhan::forward<AA>(args)...) {};
+
+        // Call the stored callable with the stored arguments. The return value, if any, is dropped.
+        template<size_t... I>
+        void invoke(index_sequence<I...>) {
+            this->template get<0>()(this->template get<I + 1>()...);
+        };
+
+        // Operator().
+        void operator()() {
+            invoke(make_index_sequence<arity>{});
+        };
+    };
+
+
+// The task type that make_task(or make_detached_task) builds for a call.
+// For a member function, the first argument is the object. It is bound into the callable instead of being stored.
+    template<template<typename...> class TT, typename F, bool M, typename... A>
+    struct task_type_helper {
+        using type = TT<F, A...>;
+    };
+
+    template<template<typename...> class TT, typename F, typename T, typename... A>
+    struct task_type_helper<TT, F, true, T, A...> {
+        using type = TT<F, A...>;
+    };
+
+    template<typename F, typename... A>
+    using task_type_for = typename task_type_helper<thread_task_implementation, typename decay<F>::type,
+            function_type_deduction<typename decay<F>::type>::is_member, typename decay<A>::type...>::type;
+
+    template<typename F, typename... A>
+    using detached_task_type_for = typename task_type_helper<detached_task_implementation, typename decay<F>::type,
+            function_type_deduction<typename decay<F>::type>::is_member, typename decay<A>::type...>::type;
+
 // Note I am NOT using shared_ptr<thread_task>, to make sure atomic of the returned pointer is truly atomic. shared_ptr is a class and an atomic deduced from it may not be truly atomic at machine level.
 //
 // When F is a static function or a functor.
@@ -576,12 +570,10 @@ namespace juwhan {
     typename enable_if<function_type_deduction<typename decay<F>::type>::is_static ||
                        function_type_deduction<typename decay<F>::type>::is_functor, thread_task *>::type
     make_task(F &&func_, A &&... args) {
+        using task_type = thread_task_implementation<typename decay<F>::type, typename decay<A>::type...>;
         // Use malloc to void* free.
-        auto thread_task_pointer = malloc(
-                sizeof(thread_task_implementation<typename decay<F>::type, typename decay<A>::type...>));
-        new(thread_task_pointer) thread_task_implementation<typename decay<F>::type, typename decay<A>::type...>{
-                ::juwhan::forward<F>(func_), ::juwhan::forward<A>(args)...};
-        return reinterpret_cast<thread_task *>(thread_task_pointer);
+        auto thread_task_pointer = malloc(sizeof(task_type));
+        return new(thread_task_pointer) task_type{::juwhan::forward<F>(func_), ::juwhan::forward<A>(args)...};
     };
 
 // When F is a member function of a class.
@@ -589,29 +581,41 @@ namespace juwhan {
     inline
     typename enable_if<function_type_deduction<typename decay<F>::type>::is_member, thread_task *>::type
     make_task(F &&func_, T &&this_, A &&... args) {
+        using task_type = thread_task_implementation<typename decay<F>::type, typename decay<A>::type...>;
         // Use malloc to void* free.
-        auto thread_task_pointer = malloc(
-                sizeof(thread_task_implementation<typename decay<F>::type, typename decay<A>::type...>));
-        new(thread_task_pointer) thread_task_implementation<typename decay<F>::type, typename decay<A>::type...>{
-                ::juwhan::forward<F>(func_), ::juwhan::forward<T>(this_), ::juwhan::forward<A>(args)...};
-        return reinterpret_cast<thread_task *>(thread_task_pointer);
+        auto thread_task_pointer = malloc(sizeof(task_type));
+        return new(thread_task_pointer) task_type{::juwhan::forward<F>(func_), ::juwhan::forward<T>(this_),
+                                                  ::juwhan::forward<A>(args)...};
     };
 
 
-} // End of namespace juwhan.
+// Detached tasks.
+//
+// When F is a static function or a functor.
+    template<typename F, typename... A>
+    inline
+    typename enable_if<function_type_deduction<typename decay<F>::type>::is_static ||
+                       function_type_deduction<typename decay<F>::type>::is_functor, thread_task *>::type
+    make_detached_task(F &&func_, A &&... args) {
+        using task_type = detached_task_type_for<F, A...>;
+        // Use malloc to void* free.
+        auto thread_task_pointer = malloc(sizeof(task_type));
+        return new(thread_task_pointer) task_type{::juwhan::forward<F>(func_), ::juwhan::forward<A>(args)...};
+    };
 
-// Undef
-#undef PARAM0
-#undef PARAM1
-#undef PARAM2
-#undef PARAM3
-#undef PARAM4
-#undef PARAM5
-#undef PARAM6
-#undef PARAM7
-#undef PARAM8
-#undef PARAM9
-#undef PARAM10
-#undef FUNC_MACRO
+// When F is a member function of a class.
+    template<typename F, typename T, typename... A>
+    inline
+    typename enable_if<function_type_deduction<typename decay<F>::type>::is_member, thread_task *>::type
+    make_detached_task(F &&func_, T &&this_, A &&... args) {
+        using task_type = detached_task_type_for<F, T, A...>;
+        // Use malloc to void* free.
+        auto thread_task_pointer = malloc(sizeof(task_type));
+        return new(thread_task_pointer) task_type{::juwhan::forward<F>(func_), ::juwhan::forward<T>(this_),
+                                                  ::juwhan::forward<A>(args)...};
+    };
+
+
+} // End of namespace juwhan.
 
 #endif
\ No newline at end of file
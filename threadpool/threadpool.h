@@ -3,6 +3,7 @@
 #define juwhan_threadpool_h
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <exception>
 #include <stdexcept>
@@ -10,9 +11,16 @@
 
 #include "thread.h"
 #include "thread_task.h"
+#include "continuation.h"
+#include "captured_graph.h"
 #include "threadlocal.h"
 #include "aligned_circular_array.h"
 #include "work_stealing_queue.h"
+#include "task_mailbox.h"
+#include "demand_flag.h"
+#include "heartbeat.h"
+#include "spawn_statistics.h"
+#include "task_sync.h"
 
 #define tp_info(...)
 #define tp_info_if(...)
@@ -29,6 +37,10 @@ namespace juwhan {
         template<typename T>
         using receipt_type = threadpool_receit<T>;
 
+        // Exceptions thrown by posted tasks have no receipt to go to. They are handed to this handler instead.
+        // Those not derived from ::std::exception are handed over as a runtime_error saying so.
+        using exception_handler_type = void (*)(::std::exception &);
+
         struct join_guard {
             ::std::vector<thread> &threads;
 
@@ -56,17 +68,38 @@ namespace juwhan {
         char pad3[JUWHAN_CACHELINE_SIZE];
         ::std::condition_variable cond;
         char pad4[JUWHAN_CACHELINE_SIZE];
+        // The number of threads capturing a graph. Read before capture_target, so that submit and post pay for the threadlocal lookup only while somebody captures.
+        ::std::atomic<size_t> capturing;
+        char pad5[JUWHAN_CACHELINE_SIZE];
         // The following are read only. No need to prevent false sharing.
         ::std::vector<queue_type_ptr> master_queues;
         ::std::vector<::std::vector<queue_type_ptr>> master_neighboring_queues;
+        ::std::vector<task_mailbox *> master_mailboxes;
+        ::std::vector<demand_flag *> master_demand_flags;
+        ::std::vector<latent_tasks *> master_latent_tasks;
+        ::std::vector<spawn_counters *> master_spawn_counters;
+        ::std::vector<wait_depth *> master_wait_depths;
         threadlocal<queue_type_ptr> my_queue;
+        threadlocal<size_t> my_index;
         threadlocal<::std::vector<queue_type_ptr> *> neighboring_queues;
+        // Non-null while this thread is capturing a graph. See captured_graph.h.
+        threadlocal<graph_capture *> capture_target;
+        exception_handler_type exception_handler;
+        // Zero unless in heartbeat mode. See heartbeat.h.
+        ::std::chrono::steady_clock::duration heartbeat_interval;
+        // See spawn_statistics.h.
+        size_t inline_threshold;
         join_guard joiner;
 
         void make_master_queues(size_t thread_count) {
             tp_info("Building queue structure for a thread pool ...");
             for (auto i = 0; i < thread_count; ++i) {
                 master_queues.push_back(new queue_type{});
+                master_mailboxes.push_back(new task_mailbox{});
+                master_demand_flags.push_back(new demand_flag{});
+                master_latent_tasks.push_back(new latent_tasks{});
+                master_spawn_counters.push_back(new spawn_counters{});
+                master_wait_depths.push_back(new wait_depth{});
             }
             tp_info("Master queue is made.");
             // Make neighboring queus and put them in the master.
@@ -87,27 +120,20 @@ namespace juwhan {
             tp_info("A worker (" + to_string(me) + ") has entered.");
             // Initialize threadlocal variables.
             my_queue.set(master_queues[me]);
+            my_index.set(me);
             tp_info("I (" + to_string(me) + ") just set my master queue.");
             neighboring_queues.set(&master_neighboring_queues[me]);
             tp_info("I (" + to_string(me) + ") just set my neighboring queues.");
             thread_task *fetched_task;
             while (!done) {
                 tp_info("I (" + to_string(me) + ") just entered the main working loop.");
+                // Latent tasks left behind by a task that did not wait for them.
+                beat();
+                if (run_latent()) continue;
                 fetched_task = fetch_task();
                 tp_info_if(fetched_task, "I(" + to_string(me) + ") fetched a job.");
                 if (fetched_task) {
-                    auto old_outstanding_count = outstanding_count.fetch_sub(1);
-                    tp_info("I am about to execute the task. My queue had " + to_string(old_outstanding_count) +
-                            " outstanding tasks and now it has " + to_string(outstanding_count.load()) + ".");
-                    (*fetched_task)();
-                    // Now wake up threads to see if a results they're waiting is ready.
-                    {
-                        tp_info("I(" + to_string(me) + ") finished a job. I'll notify all.");
-                        ::std::lock_guard<::std::mutex> lg{mut};
-                        cond.notify_all();
-                    }
-                    // Delete the done-with task.
-                    delete fetched_task;
+                    execute(fetched_task);
                 } else {
                     tp_info("I(" + to_string(me) + ") could NOT fetch a job. I intend to fall sleep.");
                     // Wait until some work is added or done flag is raised.
@@ -133,6 +159,7 @@ namespace juwhan {
             tp_info("The main queue related to thread (" + to_string(me) + ") has been flushed.");
             // Now, release the queue. Note that the threadlocal queue is just an alias to the thread specific queue.
             my_queue.release();
+            my_index.release();
             tp_info("The main queue related to thread (" + to_string(me) + ") has been released.");
             neighboring_queues.release();
             tp_info("The neighbor queues related to thread (" + to_string(me) + ") has been released.");
@@ -151,12 +178,15 @@ namespace juwhan {
 
         // The default constructor.
         threadpool(size_t thread_count = 0)
-                : done{false}, joiner{threads}, master_queues{}, my_queue{}, neighboring_queues{},
-                  master_neighboring_queues{}, outstanding_count{0}, mut{}, cond{} {
+                : done{false}, joiner{threads}, master_queues{}, master_mailboxes{}, master_demand_flags{}, master_latent_tasks{}, master_spawn_counters{}, master_wait_depths{},
+                  my_queue{}, my_index{}, neighboring_queues{},
+                  master_neighboring_queues{}, outstanding_count{0}, mut{}, cond{}, capturing{0}, capture_target{}, exception_handler{nullptr},
+                  heartbeat_interval{::std::chrono::steady_clock::duration::zero()}, inline_threshold{JUWHAN_INLINE_THRESHOLD} {
             if (thread_count == 0) thread_count = thread::hardware_concurrency();
             make_master_queues(thread_count);
             // Initialize threadlocal variables for main.
             my_queue.set(master_queues[0]);
+            my_index.set(size_t{0});
             tp_info("I(0) the master thread set my master queue.");
             neighboring_queues.set(&master_neighboring_queues[0]);
             tp_info("I(0) the master thread set my neighboring queues.");
@@ -190,8 +220,22 @@ namespace juwhan {
             // Join.
             for (auto i = 0; i < threads.size(); ++i) threads[i].join();
             tp_info("Now, all threads are joined.");
+            // No worker flushes the queue and the mailbox of this thread. Tasks left there would leak, and so would their results and continuations.
+            while (auto task = my_queue->pop()) if (task->is_pool_owned()) delete task;
+            while (auto task = master_mailboxes[my_index.get()]->pop()) if (task->is_pool_owned()) delete task;
             // Delete queues.
             for (auto i = 0; i < master_queues.size(); ++i) delete master_queues[i];
+            for (auto i = 0; i < master_mailboxes.size(); ++i) delete master_mailboxes[i];
+            for (auto i = 0; i < master_demand_flags.size(); ++i) delete master_demand_flags[i];
+            // Latent tasks of threads that are not workers, this one included, were never flushed.
+            for (auto i = 0; i < master_latent_tasks.size(); ++i) {
+                while (auto task = master_latent_tasks[i]->pop()) if (task->is_pool_owned()) delete task;
+                delete master_latent_tasks[i];
+            }
+            for (auto i = 0; i < master_spawn_counters.size(); ++i) delete master_spawn_counters[i];
+            for (auto i = 0; i < master_wait_depths.size(); ++i) delete master_wait_depths[i];
+            // The index of this thread was allocated in the constructor.
+            my_index.release();
             tp_info("Now, all master queues are deleted.");
         };
 
@@ -204,13 +248,17 @@ namespace juwhan {
 
         void flush() {
             tp_info("I will flush my queue.");
-            while (auto task = my_queue->pop()) delete task;
+            while (auto task = my_queue->pop()) if (task->is_pool_owned()) delete task;
+            while (auto task = master_mailboxes[my_index.get()]->pop()) if (task->is_pool_owned()) delete task;
+            while (auto task = master_latent_tasks[my_index.get()]->pop()) if (task->is_pool_owned()) delete task;
         };
 
 
         // Fetch a task.
         thread_task *fetch_task() {
             tp_info("OK, I am about to fetch a task.");
+            // Tasks mailed to me come first. They were sent to me for what I have in cache.
+            if (auto mailed_task = master_mailboxes[my_index.get()]->pop()) return mailed_task;
             bool is_empty{false};
             while (!is_empty) {
                 auto fetched_task = my_queue->pop();
@@ -231,28 +279,148 @@ namespace juwhan {
                 tp_info_if(is_empty, "All the queues are truly empty.");
                 tp_info_if(!is_empty, "Although I failed, it may be due to race-loss. I'll try again.");
             }
-            // At this point, all queues appear empty. Return nullptr.
+            // Nothing to steal. Take mail sent to others rather than stay idle.
+            for (auto i = 0; i < master_mailboxes.size(); ++i) {
+                if (auto mailed_task = master_mailboxes[i]->pop()) {
+                    tp_info("I took a task mailed to " + to_string(i) + ".");
+                    return mailed_task;
+                }
+            }
+            // At this point, all queues appear empty. Ask the busy ones to split off work, and return nullptr.
+            raise_demand();
             return nullptr;
         };
 
 
-        // Submit a task.
-        template<typename F, typename... A>
-        threadpool_receit<typename thread_task_implementation<typename decay<F>::type, typename decay<A>::type...>::result_type>
-        submit(F &&_func, A &&... args) {
-            using task_type = thread_task_implementation<typename decay<F>::type, typename decay<A>::type...>;
-            using result_type = typename task_type::result_type;
-            tp_info("I'll submit a task");
-            // Make a task.
-            thread_task *new_task = make_task(juwhan::forward<F>(_func), juwhan::forward<A>(args)...);
-            tp_info("I just generated a task.");
-            // Compose a receit.
-            threadpool_receit<result_type> receit{(reinterpret_cast<task_type *>(new_task))->ret, *this};
+        // Steal a task from the others: their queues, then their mail. My own queue and mail are left alone.
+        thread_task *steal_task() {
+            bool is_empty{false};
+            while (!is_empty) {
+                is_empty = true;
+                for (auto i = 0; i < neighboring_queues->size(); ++i) {
+                    auto fetched_task = (*neighboring_queues)[i]->steal();
+                    if (fetched_task) return fetched_task;
+                    if (fetched_task.state == return_state::abort) is_empty = false;
+                }
+            }
+            auto me = my_index.get();
+            for (auto i = 0; i < master_mailboxes.size(); ++i) {
+                if (i == me) continue;
+                if (auto mailed_task = master_mailboxes[i]->pop()) return mailed_task;
+            }
+            raise_demand();
+            return nullptr;
+        };
+
+
+        // Raise the demand flags of all the others.
+        void raise_demand() {
+            auto me = my_index.get();
+            for (auto i = 0; i < master_demand_flags.size(); ++i) if (i != me) master_demand_flags[i]->raise();
+        };
+
+
+        // Execute a fetched task and delete it, if the pool owns it.
+        void execute(thread_task *task) {
+            auto is_pool_owned = task->is_pool_owned();
+            auto old_outstanding_count = outstanding_count.fetch_sub(1);
+            tp_info("I am about to execute the task. My queue had " + to_string(old_outstanding_count) +
+                    " outstanding tasks and now it has " + to_string(outstanding_count.load()) + ".");
+            // Tasks with a receipt catch their own exceptions. Only detached ones throw up to here.
+            try {
+                (*task)();
+            }
+            catch (::std::exception &e) {
+                if (exception_handler) exception_handler(e);
+            }
+            catch (...) {
+                // Anything else reaches the handler as a runtime_error, so that it is not lost silently.
+                ::std::runtime_error e{"A posted task threw an exception that is not a ::std::exception."};
+                if (exception_handler) exception_handler(e);
+            }
+            // Now wake up threads to see if a results they're waiting is ready.
+            {
+                tp_info("I finished a job. I'll notify all.");
+                ::std::lock_guard<::std::mutex> lg{mut};
+                cond.notify_all();
+            }
+            // Delete the done-with task.
+            if (is_pool_owned) delete task;
+        };
+
+
+        // Help executing tasks until the condition is met. Sleep when there is nothing to help with.
+        template<typename P>
+        void help_until(P condition) {
+            tp_info("I am a waiting thread. I will try to process pending tasks while waiting.");
+            while (!condition() && !done) {
+                tp_info("I just entered task fetching cycle.");
+                // My own latent tasks come first. The one waited for is usually the newest.
+                beat();
+                if (run_latent()) continue;
+                auto fetched_task = fetch_task();
+                if (fetched_task) {
+                    tp_info("I picked up a task while waiting for a condition to be met.");
+                    execute(fetched_task);
+                } else {
+                    tp_info("I tried to meet the condition or to pick up a pending task, but could NOT do either. I intend to go into sleep.");
+                    ::std::unique_lock<::std::mutex> lock{mut};
+                    cond.wait
+                            (
+                                    lock, [this, &condition] {
+                                        return
+                                                (
+                                                        (outstanding_count.load() > 0)
+                                                        || (done.load())
+                                                        || (condition())
+                                                );
+                                    }
+                            );
+                    lock.unlock();
+                }
+            }
+        };
+
+
+        // Help with the tasks of the other threads only, until the condition is met. Sleep when there is nothing to steal.
+        // The tasks of this thread are left for the others, so that the task waited for never runs under the waiting one, e.g. the other end of a channel.
+        template<typename P>
+        void steal_until(P condition) {
+            tp_info("I am a waiting thread. I will steal from the others while waiting.");
+            promote_latent();
+            while (!condition() && !done) {
+                auto stolen_task = steal_task();
+                if (stolen_task) {
+                    execute(stolen_task);
+                } else if (outstanding_count.load() > 0) {
+                    // What is outstanding may be in my own queue. Leave it to the others.
+                    this_thread::yield();
+                } else {
+                    ::std::unique_lock<::std::mutex> lock{mut};
+                    cond.wait
+                            (
+                                    lock, [this, &condition] {
+                                        return
+                                                (
+                                                        (outstanding_count.load() > 0)
+                                                        || (done.load())
+                                                        || (condition())
+                                                );
+                                    }
+                            );
+                    lock.unlock();
+                }
+            }
+        };
+
+
+        // Push a task into my queue.
+        void enqueue(thread_task *task) {
             // Incrementing the outstanding_count before pushing in the element prevents negative count.
             auto old_outstanding_count = outstanding_count.fetch_add(1);
             tp_info("Before submitting the task, my queue had " + to_string(old_outstanding_count) +
                     " outstanding tasks and now it has " + to_string(outstanding_count.load()) + ".");
-            my_queue->push(new_task);
+            my_queue->push(task);
             if (old_outstanding_count == 0) {
                 // We need to guard this block.
                 // We want to wake up sleeping threads after they release locks, i.e., went into wait() after the while statement.
@@ -260,10 +428,242 @@ namespace juwhan {
                 ::std::lock_guard<::std::mutex> lg{mut};
                 cond.notify_all();
             }
+        };
+
+
+        // Keep a task latent in this thread, and promote the oldest one into my queue if a heartbeat is due.
+        void defer(thread_task *task) {
+            auto &latent = *master_latent_tasks[my_index.get()];
+            latent.push(task);
+            if (auto promoted_task = latent.promote(heartbeat_interval)) enqueue(promoted_task);
+        };
+
+
+        // Promote my oldest latent task into my queue if a heartbeat is due. Nothing to do unless in heartbeat mode.
+        void beat() {
+            auto &latent = *master_latent_tasks[my_index.get()];
+            if (latent.empty()) return;
+            if (auto promoted_task = latent.promote(heartbeat_interval)) enqueue(promoted_task);
+        };
+
+
+        // Promote all my latent tasks into my queue, oldest first, where the others can take them.
+        // A wait that does not run my own tasks calls it first, or a latent task that would meet its condition runs nowhere.
+        void promote_latent() {
+            auto &latent = *master_latent_tasks[my_index.get()];
+            while (auto promoted_task = latent.promote(::std::chrono::steady_clock::duration::zero())) enqueue(promoted_task);
+        };
+
+
+        // The number of latent tasks promoted by heartbeats so far, over all threads.
+        size_t promoted_count() {
+            size_t count{0};
+            for (size_t i = 0; i < master_latent_tasks.size(); ++i)
+                count += master_latent_tasks[i]->promoted.load(::std::memory_order_relaxed);
+            return count;
+        };
+
+
+        // Run the newest latent task of this thread, if any. Latent tasks are not counted as outstanding.
+        bool run_latent() {
+            auto task = master_latent_tasks[my_index.get()]->pop();
+            if (!task) return false;
+            tp_info("I will run a latent task inline.");
+            outstanding_count.fetch_add(1);
+            execute(task);
+            return true;
+        };
+
+
+        // Turn the heartbeat mode on with a beat every given microseconds, or off with 0. See heartbeat.h.
+        // Set it while the pool is idle. It is read without a lock.
+        void set_heartbeat(size_t microseconds) {
+            heartbeat_interval = ::std::chrono::microseconds{microseconds};
+        };
+
+
+        // Send a task to the worker at index. It takes the task before its own queue, and others take it only when idle.
+        void mail(thread_task *task, size_t index) {
+            auto old_outstanding_count = outstanding_count.fetch_add(1);
+            master_mailboxes[index]->push(task);
+            // The worker may be sleeping. Wake everyone, as enqueue does.
+            if (old_outstanding_count == 0) {
+                ::std::lock_guard<::std::mutex> lg{mut};
+                cond.notify_all();
+            }
+        };
+
+
+        // The number of tasks mailed so far, over all workers. Tells whether an affinity_partitioner is sending pieces back to their workers.
+        size_t mail_count() {
+            size_t count{0};
+            for (size_t i = 0; i < master_mailboxes.size(); ++i) count += master_mailboxes[i]->received_count();
+            return count;
+        };
+
+
+        // Wake the threads sleeping in help_until, to check their conditions again.
+        // A task finishing does it anyway. Call it when a condition is met in the middle of a task, e.g. by a channel. See channel.h.
+        void notify() {
+            ::std::lock_guard<::std::mutex> lg{mut};
+            cond.notify_all();
+        };
+
+
+        // Sleep until the condition is met, without running any task. Whoever meets it must call notify(). See task_sync.h.
+        template<typename P>
+        void park_until(P condition) {
+            tp_info("I will park until a condition is met.");
+            promote_latent();
+            ::std::unique_lock<::std::mutex> lock{mut};
+            cond.wait(lock, [this, &condition] { return done.load() || condition(); });
+        };
+
+
+        // How deep this thread is in waits of task_sync.h that help the pool.
+        size_t &my_wait_depth() { return master_wait_depths[my_index.get()]->value; };
+
+
+        // The demand flag of this thread. Splittable tasks poll it. See splittable_task.h.
+        demand_flag &my_demand_flag() { return *master_demand_flags[my_index.get()]; };
+
+
+        // The number of threads working on this pool, including the main thread.
+        size_t thread_count() { return master_queues.size(); };
+
+
+        // The index of this thread in the pool, from 0(the main thread) to thread_count() - 1.
+        size_t worker_index() { return my_index.get(); };
+
+
+        // Set the handler for exceptions thrown by posted tasks. Set it before posting; it is read without a lock.
+        void set_exception_handler(exception_handler_type handler) {
+            exception_handler = handler;
+        };
+
+
+        // Submit a task.
+        template<typename F, typename... A>
+        threadpool_receit<typename task_type_for<F, A...>::result_type>
+        submit(F &&_func, A &&... args) {
+            using task_type = task_type_for<F, A...>;
+            using result_type = typename task_type::result_type;
+            tp_info("I'll submit a task");
+            // In capture mode, receipts among the arguments are the dependencies. Look at them before they are forwarded.
+            auto capture = my_capture();
+            size_t node{0};
+            if (capture) {
+                node = capture->add_node();
+                int expand[] = {0, (capture->add_dependency(node, argument_dependency(args, 0)), 0)...};
+                (void) expand;
+            }
+            // Make a task.
+            thread_task *new_task = make_task(juwhan::forward<F>(_func), juwhan::forward<A>(args)...);
+            tp_info("I just generated a task.");
+            // Compose a receit.
+            threadpool_receit<result_type> receit{(static_cast<task_type *>(new_task))->ret, *this};
+            if (capture) {
+                tp_info("I am capturing. I will record the task instead of running it.");
+                capture->set_node(node, new_task, receit.ret.base);
+                return receit;
+            }
+            if (heartbeat_interval != ::std::chrono::steady_clock::duration::zero()) {
+                defer(new_task);
+                return receit;
+            }
+            enqueue(new_task);
             return receit;
         };
 
 
+        // Submit a task, or run it right here if my queue is deep enough and nobody is asking for work. See spawn_statistics.h.
+        template<typename F, typename... A>
+        threadpool_receit<typename task_type_for<F, A...>::result_type>
+        spawn_or_run(F &&_func, A &&... args) {
+            using task_type = task_type_for<F, A...>;
+            using result_type = typename task_type::result_type;
+            auto &counters = *master_spawn_counters[my_index.get()];
+            // A raised flag is answered by this spawn, so it is taken down.
+            if (my_capture() || my_queue->size() <= inline_threshold || my_demand_flag().take()) {
+                counters.count_spawned();
+                return submit(juwhan::forward<F>(_func), juwhan::forward<A>(args)...);
+            }
+            tp_info("My queue is deep and nobody is hungry. I will run the task in place.");
+            counters.count_inlined();
+            // The task lives in this frame only. The receipt keeps its result.
+            task_type local_task{juwhan::forward<F>(_func), juwhan::forward<A>(args)...};
+            local_task();
+            return threadpool_receit<result_type>{local_task.ret, *this};
+        };
+
+
+        // Set how many tasks my queue must hold before spawn_or_run runs tasks in place. Set it while the pool is idle.
+        void set_inline_threshold(size_t threshold) {
+            inline_threshold = threshold;
+        };
+
+
+        // The counts of spawn_or_run over all threads, and the threshold in use.
+        spawn_statistics spawn_stats() {
+            spawn_statistics stats{0, 0, inline_threshold};
+            for (auto i = 0; i < master_spawn_counters.size(); ++i) {
+                stats.spawned += master_spawn_counters[i]->spawned.load(::std::memory_order_relaxed);
+                stats.inlined += master_spawn_counters[i]->inlined.load(::std::memory_order_relaxed);
+            }
+            return stats;
+        };
+
+
+        // Zero the counts. Call it while the pool is idle.
+        void reset_spawn_stats() {
+            for (auto i = 0; i < master_spawn_counters.size(); ++i) master_spawn_counters[i]->reset();
+        };
+
+
+        // Post a task. Fire and forget.
+        // No result state or receipt is made. An exception thrown by the task goes to the exception handler.
+        template<typename F, typename... A>
+        void post(F &&_func, A &&... args) {
+            tp_info("I'll post a task");
+            if (auto capture = my_capture()) {
+                auto node = capture->add_node();
+                int expand[] = {0, (capture->add_dependency(node, argument_dependency(args, 0)), 0)...};
+                (void) expand;
+                capture->set_node(node, make_detached_task(juwhan::forward<F>(_func), juwhan::forward<A>(args)...),
+                                  nullptr);
+                return;
+            }
+            enqueue(make_detached_task(juwhan::forward<F>(_func), juwhan::forward<A>(args)...));
+        };
+
+
+        // The graph this thread is capturing into, or nullptr.
+        // A thread sees its own begin_capture in the count, so a zero count means this thread is not capturing.
+        graph_capture *my_capture() {
+            if (capturing.load(::std::memory_order_relaxed) == 0) return nullptr;
+            return capture_target.get();
+        };
+
+
+        // Start recording the tasks this thread submits or posts into a captured graph. Nothing is run until the graph is replayed.
+        void begin_capture(graph_capture &graph) {
+            if (my_capture())
+                throw ::std::runtime_error("A thread tried to begin a capture while it is already capturing.");
+            capturing.fetch_add(1, ::std::memory_order_relaxed);
+            capture_target.set(&graph);
+        };
+
+
+        // Stop recording and freeze the captured graph.
+        void end_capture() {
+            auto capture = my_capture();
+            if (!capture) throw ::std::runtime_error("A thread tried to end a capture it has not begun.");
+            capture_target.set(nullptr);
+            capturing.fetch_sub(1, ::std::memory_order_relaxed);
+            capture->finish();
+        };
+
+
     };
 
 // threadpool_receit is read only, hence a class instead of a struct.
@@ -289,41 +689,14 @@ namespace juwhan {
 
         void wait() {
             if (!tp) return;
-            tp_info("I am a waiting thread. I will try to process pending tasks while waiting.");
-            while (!ret.is_set() && !tp->done) {
-                tp_info("I just entered task fetching cycle.");
-                auto fetched_task = tp->fetch_task();
-                if (fetched_task) {
-                    tp_info("I picked up a task while waiting for a function result to arrive.");
-                    auto old_outstanding_count = tp->outstanding_count.fetch_sub(1);
-                    tp_info("I am about to execute the task. My queue had " + to_string(old_outstanding_count) +
-                            " outstanding tasks and now it has " + to_string(tp->outstanding_count.load()) + ".");
-                    (*fetched_task)();
-                    tp_info("A task is done while waiting for a function result. I will wake up waiting threads.");
-                    // Now wake up threads to see if a results they're waiting is ready.
-                    {
-                        ::std::lock_guard<::std::mutex> lg{tp->mut};
-                        tp->cond.notify_all();
-                    }
-                    // Delete the done-with task.
-                    delete fetched_task;
-                } else {
-                    tp_info("I tried to acquire either a function result or a pending task, but could NOT pick up any. I intend to go into sleep.");
-                    ::std::unique_lock<::std::mutex> lock{tp->mut};
-                    tp->cond.wait
-                            (
-                                    lock, [this] {
-                                        return
-                                                (
-                                                        (tp->outstanding_count.load() > 0)
-                                                        || (tp->done.load())
-                                                        || (ret.is_set())
-                                                );
-                                    }
-                            );
-                    lock.unlock();
-                }
-            }
+            tp->help_until([this] { return ret.is_set(); });
+        };
+
+        // Run func(result) on the pool once the result is set. Nobody waits in between.
+        // func takes nothing when T is void. See continuation.h.
+        template<typename F>
+        threadpool_receit<typename continuation_result<F, T>::type> then(F &&func_) {
+            return make_continuation(*tp, ret, ::juwhan::forward<F>(func_));
         };
     };
 